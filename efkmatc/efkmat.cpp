@@ -7,6 +7,7 @@ extern "C" {
 
 #include <Effekseer/Material/Effekseer.MaterialFile.h>
 #include <EffekseerRendererCommon/EffekseerRenderer.CommonUtils.h>
+#include "../renderer/bgfxmaterialmeta.h"
 
 static int
 lloadMat(lua_State *L) {
@@ -95,6 +96,23 @@ lloadMat(lua_State *L) {
 	return 1;
 }
 
+// The sidecar (.efkmat.meta) loaded by the renderer instead of the .efkmat, See renderer/bgfxmaterialmeta.h
+static int
+lmeta(lua_State *L) {
+	size_t sz;
+	const char *data = luaL_checklstring(L, 1, &sz);
+
+	Effekseer::MaterialFile mat;
+	if (!mat.Load((const uint8_t *)data, (int32_t)sz))
+		return luaL_error(L, "Invalid effekseer matrtial");
+
+	EffekseerRendererBGFX::MaterialDesc desc;
+	desc.Load(mat, data, sz);
+	std::string meta = desc.Save();
+	lua_pushlstring(L, meta.data(), meta.size());
+	return 1;
+}
+
 // layout
 
 class VertexLayout;
@@ -192,6 +210,7 @@ luaopen_efkmat(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "load", lloadMat },
 		{ "layout", llayout },
+		{ "meta", lmeta },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L, l);
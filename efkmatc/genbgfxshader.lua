@@ -175,14 +175,31 @@ local MODEL_SEMANTIC<const> = {
 	NORMAL3 	= {"a_color0", 		"COLOR0"},
 }
 
+-- modelinst : the model vertex shader with instance data (i_data0 - i_data4) instead of uniform arrays
+-- i_data0 - i_data2 : rows of model matrix, i_data3 : uv, i_data4 : color
+local INSTANCE_DATA<const> = {
+	{"i_data0", "TEXCOORD7", "InstModel0"},
+	{"i_data1", "TEXCOORD6", "InstModel1"},
+	{"i_data2", "TEXCOORD5", "InstModel2"},
+	{"i_data3", "TEXCOORD4", "InstUV"},
+	{"i_data4", "TEXCOORD3", "InstColor"},
+}
+
+local INSTANCE_UNIFORM<const> = {
+	mModel_Inst = "mtxFromRows(Input.InstModel0, Input.InstModel1, Input.InstModel2, vec4(0.0, 0.0, 0.0, 1.0))",
+	fUV = "Input.InstUV",
+	fModelColor = "Input.InstColor",
+}
+
 local VAYRING_pat = "%s %s : %s;"
 
 local function load_vs_varying(s, shadertype, modeltype)
 	local input, output = {}, {}
 	local input_names, output_names = {}, {}
 	local map = {}
-	local layout = modeltype == "model" and efkmat.model_layout or efkmat.layout(ShaderType[shadertype])
-	local mapper = modeltype == "model" and MODEL_SEMANTIC or SPRITE_SEMANTIC
+	local ismodel = modeltype == "model" or modeltype == "modelinst"
+	local layout = ismodel and efkmat.model_layout or efkmat.layout(ShaderType[shadertype])
+	local mapper = ismodel and MODEL_SEMANTIC or SPRITE_SEMANTIC
 
 	for i, v in ipairs(s.layout) do
 		local location = v.id + 1
@@ -202,6 +219,13 @@ local function load_vs_varying(s, shadertype, modeltype)
 		end
 	end
 
+	if modeltype == "modelinst" then
+		for _, v in ipairs(INSTANCE_DATA) do
+			input[#input+1] = VAYRING_pat:format("vec4", v[1], v[2])
+			input_names[#input_names+1] = v[1]
+		end
+	end
+
 	return {
 		file	= table.concat(input, "\n") .. "\n" .. table.concat(output, "\n"),
 		map		= map,
@@ -237,13 +261,15 @@ local function gen_varying(s, stagetype, shadertype, modeltype)
 	return load_fs_varying(s)
 end
 
-local function gen_uniform(s, stage)
+local function gen_uniform(s, stage, modeltype)
 	local uniform = {}
 	local map = {}
 	local u = s.uniform[1]
 	for i,item in ipairs(u) do
 		local uname = stage == "vs" and "u_" .. item.name or "u_fs" .. item.name
-		if item.array then
+		if modeltype == "modelinst" and INSTANCE_UNIFORM[item.name] then
+			-- read from instance data, See gen_instance
+		elseif item.array then
 			table.insert(uniform, string.format("uniform %s %s[%d];",item.type, uname, item.array))
 		else
 			table.insert(uniform, string.format("uniform %s %s;",item.type, uname))
@@ -271,6 +297,30 @@ local function gen_texture(s)
 	}
 end
 
+local function gen_instance(s, func)
+	for _, v in ipairs(s.struct) do
+		if v.name == "VS_Input" then
+			local fields = {}
+			for _, d in ipairs(INSTANCE_DATA) do
+				fields[#fields+1] = ("    vec4 %s;\n"):format(d[3])
+			end
+			v.data = v.data:gsub("};$", table.concat(fields) .. "};")
+		end
+	end
+	for _, f in ipairs(func) do
+		for name, value in pairs(INSTANCE_UNIFORM) do
+			f.imp = f.imp:gsub("u_" .. name .. "%[[%w_]+%]", value)
+		end
+	end
+	func.main.imp = func.main.imp:gsub("([ \t]*)(Input%.Index%s*=[^;]+;)", function (indent, line)
+		local t = { indent .. line }
+		for _, d in ipairs(INSTANCE_DATA) do
+			t[#t+1] = ("%sInput.%s = %s;"):format(indent, d[3], d[1])
+		end
+		return table.concat(t, "\n")
+	end)
+end
+
 local shader_temp=[[
 $header
 
@@ -287,7 +337,7 @@ $source
 local function genshader(fullname, stagetype, type, modeltype)
 	local s = gen(fullname)
 	local varying = gen_varying(s, stagetype, type, modeltype)
-	local uniform = gen_uniform(s, stagetype)
+	local uniform = gen_uniform(s, stagetype, modeltype)
 	local texture = gen_texture(s)
 
 	local func = s.func
@@ -384,6 +434,10 @@ local function genshader(fullname, stagetype, type, modeltype)
 		end
 	end
 
+	if modeltype == "modelinst" then
+		gen_instance(s, func)
+	end
+
 	local source = {}
 	for i, v in ipairs(s.func) do
 		source[i] = v.desc .. "\n" .. v.imp
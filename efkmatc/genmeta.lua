@@ -0,0 +1,48 @@
+-- Generate the sidecar of a material : lua genmeta.lua input.efkmat output cpath platform
+-- The output is input.efkmat.meta if it's empty, the renderer loads it instead of parsing the material.
+local input 		= arg[1]
+local output 		= arg[2]
+local cpath			= arg[3]
+local plat			= arg[4]
+
+plat = plat:lower()
+local plat_suffix = {
+	macos = ".so",
+	windows = ".dll",
+	ios = ".so",
+}
+
+local suffix = plat_suffix[plat]
+if suffix == nil then
+	error(("not support platform:"):format(plat or ""))
+end
+
+local function topath(p)
+	return p .. "/?" .. suffix
+end
+package.cpath = table.concat({
+	topath(cpath),
+	topath ".",
+	topath "efkmatc",
+}, ";")
+
+local efkmat = require "efkmat"
+
+local function readfile(filename)
+	local f = assert(io.open(filename, "rb"))
+	local data = f:read "a"
+	f:close()
+	return data
+end
+
+local function writefile(filename, data)
+	local f = assert(io.open(filename, "wb"))
+	f:write(data)
+	f:close()
+end
+
+if output == nil or output == "" then
+	output = input .. ".meta"
+end
+
+writefile(output, efkmat.meta(readfile(input)))
@@ -0,0 +1,500 @@
+// Headless CPU benchmark of the renderer, on bgfx Noop renderer.
+//
+// benchmark [-n instances] [-f frames] [-w warmup] [-prewarm] [-format json|csv] [-o file] [-matdir dir] [effect ...]
+//
+// Run it in `examples` dir, the shaders are loaded from `../shaders`, and the effects from `resources`.
+// Each effect is played with `instances` instances (replayed when finished), and the time of
+// Manager::Update, BeginRendering, Manager::Draw and EndRendering is measured separately per frame.
+// The startup time (creating the renderers, and PrewarmShaders with -prewarm) and the first frame of each effect are measured too.
+// With -prewarm, each effect is prewarmed (EffekseerRendererBGFX::Prewarm) before it's played.
+// The shaders of user defined materials (foo.efkmat) are loaded from foo_<name>_<type>.fx.bin, in the directory of
+// the material or in -matdir, the materials without them are not drawn.
+
+#include <bx/file.h>
+#include <bgfx/bgfx.h>
+#include <bgfx/c99/bgfx.h>
+
+#include "renderer/bgfxrenderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+static const bgfx::ViewId g_viewId = 0;
+static const uint32_t g_width = 1280;
+static const uint32_t g_height = 720;
+
+enum Phase {
+	PHASE_UPDATE,
+	PHASE_BEGIN,
+	PHASE_DRAW,
+	PHASE_END,
+	PHASE_COUNT,
+};
+
+static const char * g_phaseName[PHASE_COUNT] = {
+	"update",
+	"begin_rendering",
+	"draw",
+	"end_rendering",
+};
+
+struct Startup {
+	double create;	// microseconds, CreateRenderer and CreateModelRenderer
+	double prewarm;	// PrewarmShaders, 0 if the shaders are loaded on first use
+};
+
+struct Result {
+	std::string effect;
+	int instances;
+	Startup startup;
+	double effectPrewarm;	// microseconds, Prewarm of the effect, 0 without -prewarm
+	double firstFrame;	// microseconds, all the phases of the first frame
+	std::vector<double> time[PHASE_COUNT];	// microseconds per frame
+	double drawCalls;	// average per frame
+	double uniformSubmits;
+	double vertexBytesUsed;
+	double stateChanges;
+	double forcedFlushes;
+};
+
+static const bgfx::Memory*
+loadMem(const char* filename) {
+	bx::FileReader reader;
+	if (!bx::open(&reader, filename))
+		return nullptr;
+	uint32_t size = (uint32_t)bx::getSize(&reader);
+	const bgfx::Memory* mem = bgfx::alloc(size+1);
+	bx::read(&reader, mem->data, size, bx::ErrorAssert{});
+	bx::close(&reader);
+	mem->data[mem->size-1] = '\0';
+	return mem;
+}
+
+static const char*
+findShaderFile(const char* name, const char* type){
+	static const struct {
+		const char *name;
+		const char *vs;
+		const char *fs;
+	} shaders[] = {
+		{ "sprite_unlit", 			"../shaders/sprite_unlit_vs.fx.bin", 		"../shaders/model_unlit_ps.fx.bin" },
+		{ "sprite_lit", 			"../shaders/sprite_lit_vs.fx.bin", 			"../shaders/model_lit_ps.fx.bin" },
+		{ "sprite_distortion", 		"../shaders/sprite_distortion_vs.fx.bin", 	"../shaders/model_distortion_ps.fx.bin" },
+		{ "sprite_adv_unlit", 		"../shaders/ad_sprite_unlit_vs.fx.bin", 	"../shaders/ad_model_unlit_ps.fx.bin" },
+		{ "sprite_adv_lit", 		"../shaders/ad_sprite_lit_vs.fx.bin", 		"../shaders/ad_model_lit_ps.fx.bin" },
+		{ "sprite_adv_distortion", 	"../shaders/ad_sprite_distortion_vs.fx.bin","../shaders/ad_model_distortion_ps.fx.bin" },
+		{ "model_unlit", 			"../shaders/model_unlit_vs.fx.bin", 		"../shaders/model_unlit_ps.fx.bin" },
+		{ "model_lit", 				"../shaders/model_lit_vs.fx.bin", 			"../shaders/model_lit_ps.fx.bin" },
+		{ "model_distortion", 		"../shaders/model_distortion_vs.fx.bin", 	"../shaders/model_distortion_ps.fx.bin" },
+		{ "model_adv_unlit", 		"../shaders/ad_model_unlit_vs.fx.bin", 		"../shaders/ad_model_unlit_ps.fx.bin" },
+		{ "model_adv_lit", 			"../shaders/ad_model_lit_vs.fx.bin", 		"../shaders/ad_model_lit_ps.fx.bin" },
+		{ "model_adv_distortion", 	"../shaders/ad_model_distortion_vs.fx.bin", "../shaders/ad_model_distortion_ps.fx.bin" },
+		{ "model_unlit_inst", 		"../shaders/modelinst_unlit_vs.fx.bin", 	"../shaders/model_unlit_ps.fx.bin" },
+		{ "model_lit_inst", 		"../shaders/modelinst_lit_vs.fx.bin", 		"../shaders/model_lit_ps.fx.bin" },
+		{ "model_distortion_inst", 	"../shaders/modelinst_distortion_vs.fx.bin","../shaders/model_distortion_ps.fx.bin" },
+	};
+	for (const auto &s : shaders) {
+		if (strcmp(name, s.name) == 0)
+			return strcmp(type, "vs") == 0 ? s.vs : s.fs;
+	}
+	return nullptr;
+}
+
+// The compiled shaders of user defined materials, See -matdir
+static std::string g_materialDir;
+
+// foo/bar.efkmat -> <matdir>/bar_<name>_<type>.fx.bin, <matdir> is foo/ by default
+static std::string
+materialShaderFile(const char *mat, const char* name, const char* type){
+	std::string path(mat);
+	const size_t slash = path.find_last_of("/\\");
+	std::string stem = slash == std::string::npos ? path : path.substr(slash + 1);
+	const size_t dot = stem.rfind('.');
+	if (dot != std::string::npos)
+		stem.resize(dot);
+	std::string dir = g_materialDir.empty() ? (slash == std::string::npos ? "" : path.substr(0, slash + 1)) : g_materialDir + "/";
+	return dir + stem + "_" + name + "_" + type + ".fx.bin";
+}
+
+static bgfx_shader_handle_t ShaderLoad(const char *mat, const char *name, const char *type, void *ud){
+	std::string matfile;
+	if (mat)
+		matfile = materialShaderFile(mat, name, type);
+	const char* shaderfile = mat ? matfile.c_str() : findShaderFile(name, type);
+	const bgfx::Memory* mem = shaderfile ? loadMem(shaderfile) : nullptr;
+	if (mem == nullptr) {
+		// The instanced variants are optional
+		if (mat && strstr(name, "_inst") == nullptr)
+			fprintf(stderr, "Can't load material shader %s\n", shaderfile);
+		return bgfx_shader_handle_t{ UINT16_MAX };
+	}
+	bgfx::ShaderHandle handle = bgfx::createShader(mem);
+	return bgfx_shader_handle_t{handle.idx};
+}
+
+// The textures are not loaded, the renderer only needs valid handles.
+static bgfx::TextureHandle createWhiteTexture() {
+	static const uint32_t white = 0xffffffff;
+	return bgfx::createTexture2D(1, 1, false, 1, bgfx::TextureFormat::RGBA8, BGFX_SAMPLER_NONE, bgfx::copy(&white, sizeof(white)));
+}
+
+static int TextureLoad(const char *name, int srgb, void *ud){
+	auto handle = createWhiteTexture();
+	if (handle.idx == 0xffff)
+		return -1;
+	return handle.idx;
+}
+
+static void TextureUnload(int id, void *ud){
+	bgfx::destroy(bgfx::TextureHandle{uint16_t(id & 0xffff)});
+}
+
+static bgfx_texture_handle_t TextureHandle(int id, void *ud) {
+	bgfx_texture_handle_t ret { uint16_t(id & 0xffff) };
+	return ret;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+	if (sorted.empty())
+		return 0;
+	size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+static double mean(const std::vector<double> &v) {
+	double sum = 0;
+	for (double t : v)
+		sum += t;
+	return v.empty() ? 0 : sum / v.size();
+}
+
+class Benchmark {
+public:
+	// Background and depth are white textures, so the distortion effects are rendered too.
+	static bgfx_texture_handle_t TextureGet(int texture_type, void *parm, void *ud){
+		Benchmark *that = (Benchmark *)ud;
+		if (texture_type == TEXTURE_DEPTH){
+			EffekseerRenderer::DepthReconstructionParameter *p = (EffekseerRenderer::DepthReconstructionParameter*)parm;
+			p->DepthBufferScale = 1.0f;
+			p->DepthBufferOffset = 0.0f;
+			p->ProjectionMatrix33 = that->m_projMat.Values[2][2];
+			p->ProjectionMatrix34 = that->m_projMat.Values[2][3];
+			p->ProjectionMatrix43 = that->m_projMat.Values[3][2];
+			p->ProjectionMatrix44 = that->m_projMat.Values[3][3];
+		}
+		return { that->m_white.idx };
+	}
+
+	bool init(bool prewarm) {
+		bgfx::Init init;
+		init.type = bgfx::RendererType::Noop;
+		init.resolution.width  = g_width;
+		init.resolution.height = g_height;
+		init.resolution.reset  = BGFX_RESET_NONE;
+		if (!bgfx::init(init))
+			return false;
+
+		bgfx::setViewMode(g_viewId, bgfx::ViewMode::Sequential);
+		bgfx::setViewRect(g_viewId, 0, 0, uint16_t(g_width), uint16_t(g_height));
+		m_white = createWhiteTexture();
+
+		EffekseerRendererBGFX::InitArgs efkArgs {
+			8192, g_viewId, bgfx_get_interface(BGFX_API_VERSION),
+			ShaderLoad,
+			TextureGet,
+			TextureLoad,
+			TextureUnload,
+			TextureHandle,
+			this,
+			false,
+			true,
+		};
+		auto t0 = Clock::now();
+		m_efkRenderer = EffekseerRendererBGFX::CreateRenderer(&efkArgs);
+		if (m_efkRenderer == nullptr)
+			return false;
+		auto modelRenderer = CreateModelRenderer(m_efkRenderer, &efkArgs);
+		auto t1 = Clock::now();
+		m_startup.create = elapsed(t0, t1);
+		m_startup.prewarm = 0;
+		m_prewarm = prewarm;
+		if (prewarm) {
+			if (!EffekseerRendererBGFX::PrewarmShaders(m_efkRenderer))
+				fprintf(stderr, "Some shaders can't be loaded\n");
+			m_startup.prewarm = elapsed(t1, Clock::now());
+		}
+		m_efkManager = Effekseer::Manager::Create(8000);
+		m_efkManager->GetSetting()->SetCoordinateSystem(Effekseer::CoordinateSystem::LH);
+
+		m_efkManager->SetModelRenderer(modelRenderer);
+		m_efkManager->SetSpriteRenderer(m_efkRenderer->CreateSpriteRenderer());
+		m_efkManager->SetRibbonRenderer(m_efkRenderer->CreateRibbonRenderer());
+		m_efkManager->SetRingRenderer(m_efkRenderer->CreateRingRenderer());
+		m_efkManager->SetTrackRenderer(m_efkRenderer->CreateTrackRenderer());
+		m_efkManager->SetTextureLoader(m_efkRenderer->CreateTextureLoader());
+		m_efkManager->SetModelLoader(m_efkRenderer->CreateModelLoader());
+		m_efkManager->SetMaterialLoader(m_efkRenderer->CreateMaterialLoader());
+		m_efkManager->SetCurveLoader(Effekseer::MakeRefPtr<Effekseer::CurveLoader>());
+
+		Effekseer::Matrix44 viewMat;
+		m_projMat.PerspectiveFovLH(90.0f / 180.0f * 3.14159265f, g_width/float(g_height), 1.0f, 500.0f);
+		viewMat.LookAtLH(Effekseer::Vector3D(0.0f, 0.0f, 40.0f), Effekseer::Vector3D(0.0f, 0.0f, 0.0f), Effekseer::Vector3D(0.0f, 1.0f, 0.0f));
+		m_efkRenderer->SetProjectionMatrix(m_projMat);
+		m_efkRenderer->SetCameraMatrix(viewMat);
+		return true;
+	}
+
+	void shutdown() {
+		m_efkManager = nullptr;
+		m_efkRenderer = nullptr;
+		bgfx::destroy(m_white);
+		bgfx::shutdown();
+	}
+
+	bool run(const char *filename, int instances, int frames, int warmup, Result &result) {
+		char16_t path[1024];
+		Effekseer::ConvertUtf8ToUtf16(path, 1024, filename);
+		auto effect = Effekseer::Effect::Create(m_efkManager, path);
+		if (effect == nullptr) {
+			fprintf(stderr, "Can't load %s\n", filename);
+			return false;
+		}
+		result.effectPrewarm = 0;
+		if (m_prewarm) {
+			EffekseerRendererBGFX::PrewarmReport report;
+			if (!EffekseerRendererBGFX::Prewarm(m_efkRenderer, effect, &report))
+				fprintf(stderr, "Prewarm %s : %d failures\n", filename, report.failures);
+			result.effectPrewarm = report.programTime + report.modelTime + report.layoutTime + report.textureTime;
+		}
+		std::vector<Effekseer::Handle> handles(instances);
+		for (int i=0;i<instances;i++) {
+			handles[i] = play(effect, i, instances);
+		}
+
+		result.effect = filename;
+		result.instances = instances;
+		result.startup = m_startup;
+		result.firstFrame = 0;
+		EffekseerRendererBGFX::FrameStats stats;
+		EffekseerRendererBGFX::GetFrameStats(m_efkRenderer, &stats);
+		double drawCalls = 0, uniformSubmits = 0, vertexBytesUsed = 0, stateChanges = 0, forcedFlushes = 0;
+
+		for (int f=0;f<warmup+frames;f++) {
+			for (int i=0;i<instances;i++) {
+				if (!m_efkManager->Exists(handles[i]))
+					handles[i] = play(effect, i, instances);
+			}
+			double t[PHASE_COUNT];
+			auto t0 = Clock::now();
+			m_efkManager->Update();
+			auto t1 = Clock::now();
+			m_efkRenderer->BeginRendering();
+			auto t2 = Clock::now();
+			Effekseer::Manager::DrawParameter drawParameter;
+			drawParameter.ZNear = 0.0f;
+			drawParameter.ZFar = 1.0f;
+			drawParameter.ViewProjectionMatrix = m_efkRenderer->GetCameraProjectionMatrix();
+			m_efkManager->Draw(drawParameter);
+			auto t3 = Clock::now();
+			m_efkRenderer->EndRendering();
+			auto t4 = Clock::now();
+			bgfx::frame();
+
+			t[PHASE_UPDATE] = elapsed(t0, t1);
+			t[PHASE_BEGIN] = elapsed(t1, t2);
+			t[PHASE_DRAW] = elapsed(t2, t3);
+			t[PHASE_END] = elapsed(t3, t4);
+
+			EffekseerRendererBGFX::GetFrameStats(m_efkRenderer, &stats);
+			if (f == 0) {
+				result.firstFrame = elapsed(t0, t4);
+			}
+			if (f >= warmup) {
+				for (int p=0;p<PHASE_COUNT;p++) {
+					result.time[p].push_back(t[p]);
+				}
+				drawCalls += stats.drawCalls;
+				uniformSubmits += stats.uniformSubmits;
+				vertexBytesUsed += stats.vertexBytesUsed;
+				stateChanges += stats.stateChanges;
+				forcedFlushes += stats.forcedFlushes;
+			}
+		}
+		result.drawCalls = drawCalls / frames;
+		result.uniformSubmits = uniformSubmits / frames;
+		result.vertexBytesUsed = vertexBytesUsed / frames;
+		result.stateChanges = stateChanges / frames;
+		result.forcedFlushes = forcedFlushes / frames;
+
+		m_efkManager->StopAllEffects();
+		m_efkManager->Update();
+		return true;
+	}
+private:
+	typedef std::chrono::steady_clock Clock;
+	static double elapsed(Clock::time_point from, Clock::time_point to) {
+		return std::chrono::duration<double, std::micro>(to - from).count();
+	}
+	Effekseer::Handle play(const Effekseer::EffectRef &effect, int index, int instances) {
+		// spread the instances on a grid in front of the camera
+		int side = 1;
+		while (side * side < instances)
+			++side;
+		const float spacing = 40.0f / side;
+		float x = (index % side - (side - 1) * 0.5f) * spacing;
+		float y = (index / side - (side - 1) * 0.5f) * spacing;
+		return m_efkManager->Play(effect, x, y, 0.0f);
+	}
+
+	EffekseerRenderer::RendererRef m_efkRenderer = nullptr;
+	Effekseer::ManagerRef m_efkManager = nullptr;
+	Effekseer::Matrix44 m_projMat;
+	Startup m_startup = {};
+	bool m_prewarm = false;
+	bgfx::TextureHandle m_white = BGFX_INVALID_HANDLE;
+};
+
+static std::string jsonEscape(const std::string &s) {
+	std::string ret;
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if ((unsigned char)c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			ret += buf;
+		} else {
+			ret += c;
+		}
+	}
+	return ret;
+}
+
+static void reportJson(FILE *f, const std::vector<Result> &results) {
+	fprintf(f, "[\n");
+	for (size_t r=0;r<results.size();r++) {
+		const auto &result = results[r];
+		fprintf(f, "  {\n    \"effect\": \"%s\",\n    \"instances\": %d,\n    \"frames\": %d,\n",
+			jsonEscape(result.effect).c_str(), result.instances, (int)result.time[0].size());
+		fprintf(f, "    \"draw_calls\": %.1f,\n    \"uniform_submits\": %.1f,\n    \"vertex_bytes\": %.1f,\n",
+			result.drawCalls, result.uniformSubmits, result.vertexBytesUsed);
+		fprintf(f, "    \"state_changes\": %.1f,\n    \"forced_flushes\": %.1f,\n",
+			result.stateChanges, result.forcedFlushes);
+		fprintf(f, "    \"startup_us\": %.2f,\n    \"prewarm_us\": %.2f,\n    \"effect_prewarm_us\": %.2f,\n    \"first_frame_us\": %.2f,\n",
+			result.startup.create, result.startup.prewarm, result.effectPrewarm, result.firstFrame);
+		for (int p=0;p<PHASE_COUNT;p++) {
+			std::vector<double> sorted = result.time[p];
+			std::sort(sorted.begin(), sorted.end());
+			fprintf(f, "    \"%s\": { \"mean\": %.2f, \"min\": %.2f, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f }%s\n",
+				g_phaseName[p], mean(sorted), percentile(sorted, 0), percentile(sorted, 0.5),
+				percentile(sorted, 0.9), percentile(sorted, 0.99), percentile(sorted, 1),
+				p == PHASE_COUNT - 1 ? "" : ",");
+		}
+		fprintf(f, "  }%s\n", r == results.size() - 1 ? "" : ",");
+	}
+	fprintf(f, "]\n");
+}
+
+static void reportCsv(FILE *f, const std::vector<Result> &results) {
+	fprintf(f, "effect,instances,phase,mean_us,min_us,p50_us,p90_us,p99_us,max_us,draw_calls,uniform_submits,vertex_bytes,state_changes,forced_flushes,startup_us,prewarm_us,effect_prewarm_us,first_frame_us\n");
+	for (const auto &result : results) {
+		for (int p=0;p<PHASE_COUNT;p++) {
+			std::vector<double> sorted = result.time[p];
+			std::sort(sorted.begin(), sorted.end());
+			fprintf(f, "%s,%d,%s,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%.2f\n",
+				result.effect.c_str(), result.instances, g_phaseName[p], mean(sorted),
+				percentile(sorted, 0), percentile(sorted, 0.5), percentile(sorted, 0.9),
+				percentile(sorted, 0.99), percentile(sorted, 1),
+				result.drawCalls, result.uniformSubmits, result.vertexBytesUsed,
+				result.stateChanges, result.forcedFlushes,
+				result.startup.create, result.startup.prewarm, result.effectPrewarm, result.firstFrame);
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	int instances = 10;
+	int frames = 600;
+	int warmup = 60;
+	bool prewarm = false;
+	const char *format = "json";
+	const char *output = nullptr;
+	std::vector<const char *> effects;
+
+	for (int i=1;i<argc;i++) {
+		const char *arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(arg, "-n") == 0 && hasValue) {
+			instances = atoi(argv[++i]);
+		} else if (strcmp(arg, "-f") == 0 && hasValue) {
+			frames = atoi(argv[++i]);
+		} else if (strcmp(arg, "-w") == 0 && hasValue) {
+			warmup = atoi(argv[++i]);
+		} else if (strcmp(arg, "-prewarm") == 0) {
+			prewarm = true;
+		} else if (strcmp(arg, "-format") == 0 && hasValue) {
+			format = argv[++i];
+		} else if (strcmp(arg, "-o") == 0 && hasValue) {
+			output = argv[++i];
+		} else if (strcmp(arg, "-matdir") == 0 && hasValue) {
+			g_materialDir = argv[++i];
+		} else if (arg[0] == '-') {
+			fprintf(stderr, "Usage: %s [-n instances] [-f frames] [-w warmup] [-prewarm] [-format json|csv] [-o file] [-matdir dir] [effect ...]\n", argv[0]);
+			return 1;
+		} else {
+			effects.push_back(arg);
+		}
+	}
+	if (effects.empty()) {
+		effects = {
+			"resources/Laser01.efk",
+			"resources/Light.efk",
+			"resources/Simple_Model_UV.efkefc",
+			"resources/sword_ember.efkefc",
+			"resources/sword_lightning.efkefc",
+			"resources/toonwater.efk",
+		};
+	}
+	if (instances < 1 || frames < 1 || warmup < 0) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+	Benchmark benchmark;
+	if (!benchmark.init(prewarm)) {
+		fprintf(stderr, "Init failed\n");
+		return 1;
+	}
+	std::vector<Result> results;
+	for (auto filename : effects) {
+		Result result;
+		if (benchmark.run(filename, instances, frames, warmup, result))
+			results.push_back(std::move(result));
+	}
+	benchmark.shutdown();
+
+	FILE *f = output ? fopen(output, "wb") : stdout;
+	if (f == nullptr) {
+		fprintf(stderr, "Can't open %s\n", output);
+		return 1;
+	}
+	if (strcmp(format, "csv") == 0) {
+		reportCsv(f, results);
+	} else {
+		reportJson(f, results);
+	}
+	if (f != stdout)
+		fclose(f);
+	return results.size() == effects.size() ? 0 : 1;
+}
@@ -64,6 +64,7 @@ public:
 			EffekseerBgfxTest::TextureHandle,
 			this,
 			invz,
+			true,	// g_defaultViewId is sequential
 		};
 
 		initFullScreen();
@@ -336,6 +337,10 @@ private:
 		CHECK_SHADER("model_adv_lit", 			"../shaders/ad_model_lit_vs.fx.bin", 		"../shaders/ad_model_lit_ps.fx.bin");
 		CHECK_SHADER("model_adv_distortion", 	"../shaders/ad_model_distortion_vs.fx.bin", "../shaders/ad_model_distortion_ps.fx.bin");
 
+		CHECK_SHADER("model_unlit_inst", 		"../shaders/modelinst_unlit_vs.fx.bin", 	"../shaders/model_unlit_ps.fx.bin");
+		CHECK_SHADER("model_lit_inst", 			"../shaders/modelinst_lit_vs.fx.bin", 		"../shaders/model_lit_ps.fx.bin");
+		CHECK_SHADER("model_distortion_inst", 	"../shaders/modelinst_distortion_vs.fx.bin", "../shaders/model_distortion_ps.fx.bin");
+
 		assert(false && "invalid shader name and type name");
 		return nullptr;
 	}
@@ -437,6 +442,9 @@ private:
 		bgfx::setName(handle, name);
 		if (handle.idx == 0xffff)
 			return -1;
+		// The texture is ready, so the renderer doesn't need to call TextureHandle for it
+		EffekseerBgfxTest *that = (EffekseerBgfxTest *)ud;
+		EffekseerRendererBGFX::SetTextureHandle(that->m_efkRenderer, handle.idx, bgfx_texture_handle_t{handle.idx});
 		return handle.idx;
 	}
 
@@ -146,4 +146,41 @@ lm:exe "example"{
     linkdirs = {
         BgfxBinDir:string(),
     }
-}
\ No newline at end of file
+}
+--------------------------benchmark
+lm:exe "benchmark"{
+    deps = {
+        "efklib",
+        "efkbgfx",
+        "efkmat",
+        "shader_binaries",
+        "copy_bgfx",
+    },
+    includes = {
+        alloca_file_includes[Plat]:string(),
+        EfkLib_Includes,
+        "../",
+    },
+    sources = {
+        "benchmark.cpp",
+    },
+    defines = {
+        "BX_CONFIG_DEBUG=" .. (lm.mode == "debug" and 1 or 0),
+    },
+    links = {
+        bx_libname,
+        bgfx_libname,
+        "DelayImp",
+        "gdi32",
+        "psapi",
+        "kernel32",
+        "user32",
+        "advapi32",
+        "shell32",
+        "ole32",
+        "uuid",
+    },
+    linkdirs = {
+        BgfxBinDir:string(),
+    }
+}
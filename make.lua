@@ -4,3 +4,4 @@ lm.EfkDir = "../../"
 lm.BgfxBinDir = "../bgfx/.build/win64_vs2022/bin"
 lm:import "shaders/make.lua"
 lm:import "renderer/make.lua"
+lm:import "mock/make.lua"
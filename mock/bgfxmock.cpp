@@ -0,0 +1,865 @@
+#include "bgfxmock.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#define MOCK_MAX_HANDLES 4096
+#define MOCK_MAX_ENCODERS 8
+
+// see bgfx/src/shader.h
+#define SHADER_MAGIC_VSH 0x485356	// 'V','S','H'
+#define SHADER_MAGIC_FSH 0x485346	// 'F','S','H'
+#define SHADER_MAGIC_CSH 0x485343	// 'C','S','H'
+#define SHADER_UNIFORM_MASK 0xf0	// fragment, sampler, readonly and compare bits
+
+struct bgfx_encoder_s {
+	int index;
+	bool used;
+	uint64_t state;
+	uint32_t vertices;
+	uint32_t indices;
+	uint32_t instances;
+};
+
+namespace BgfxMock {
+
+namespace {
+
+class HandlePool {
+private:
+	std::vector<uint16_t> m_free;
+	std::vector<bool> m_alive;
+	uint16_t m_next = 0;
+public:
+	uint16_t Alloc() {
+		uint16_t idx;
+		if (!m_free.empty()) {
+			idx = m_free.back();
+			m_free.pop_back();
+		} else if (m_next < MOCK_MAX_HANDLES) {
+			idx = m_next++;
+			m_alive.push_back(false);
+		} else {
+			return UINT16_MAX;
+		}
+		m_alive[idx] = true;
+		return idx;
+	}
+	void Free(uint16_t idx) {
+		assert(IsAlive(idx));
+		if (!IsAlive(idx))
+			return;
+		m_alive[idx] = false;
+		m_free.push_back(idx);
+	}
+	bool IsAlive(uint16_t idx) const {
+		return idx < m_next && m_alive[idx];
+	}
+	int Alive() const {
+		return (int)(m_next - m_free.size());
+	}
+	void Clear() {
+		m_free.clear();
+		m_alive.clear();
+		m_next = 0;
+	}
+};
+
+struct Memory {
+	bgfx_memory_t mem;	// must be the first member
+	bgfx_release_fn_t release;
+	void *ud;
+	bool owned;
+};
+
+struct Uniform {
+	std::string name;
+	bgfx_uniform_type_t type;
+	uint16_t num;
+	int ref;
+};
+
+struct Context {
+	std::mutex lock;
+	HandlePool shaders;
+	HandlePool programs;
+	HandlePool textures;
+	HandlePool uniforms;
+	HandlePool vertexBuffers;
+	HandlePool indexBuffers;
+	HandlePool dynamicVertexBuffers;
+	HandlePool layouts;
+	std::vector<std::vector<uint16_t>> shaderUniforms;
+	std::vector<std::vector<uint16_t>> programShaders;	// destroyed with the program
+	std::vector<Uniform> uniformInfo;
+	std::unordered_set<Memory *> memories;
+	std::vector<uint8_t> transient;
+	uint32_t transientUsed = 0;
+	uint32_t frame = 0;
+	bgfx_encoder_s encoders[MOCK_MAX_ENCODERS] = {};
+	std::vector<TraceEvent> trace;
+	Counters counters = {};
+	bgfx_interface_vtbl_t vtbl = {};
+};
+
+Context *g_ctx = nullptr;
+
+typedef std::lock_guard<std::mutex> Lock;
+
+static const char * s_predefined[] = {
+	"u_viewRect", "u_viewTexel", "u_view", "u_invView", "u_proj", "u_invProj", "u_viewProj", "u_invViewProj",
+	"u_model", "u_modelView", "u_modelViewProj", "u_alphaRef4",
+};
+
+static int
+UniformSize(bgfx_uniform_type_t type) {
+	switch (type) {
+	case BGFX_UNIFORM_TYPE_VEC4:
+		return 4 * sizeof(float);
+	case BGFX_UNIFORM_TYPE_MAT3:
+		return 3 * 3 * sizeof(float);
+	case BGFX_UNIFORM_TYPE_MAT4:
+		return 4 * 4 * sizeof(float);
+	default:
+		return 0;
+	}
+}
+
+static int
+AttribSize(bgfx_attrib_type_t type, uint8_t num) {
+	static const uint8_t size[BGFX_ATTRIB_TYPE_COUNT][4] = {
+		{ 1, 2, 4, 4 },	// Uint8
+		{ 4, 4, 4, 4 },	// Uint10
+		{ 2, 4, 8, 8 },	// Int16
+		{ 2, 4, 8, 8 },	// Half
+		{ 4, 8, 12, 16 },	// Float
+	};
+	assert(type < BGFX_ATTRIB_TYPE_COUNT && num >= 1 && num <= 4);
+	return size[type][num - 1];
+}
+
+template <typename T>
+static void
+Resize(std::vector<T> &v, uint16_t idx) {
+	if (idx >= v.size())
+		v.resize(idx + 1);
+}
+
+static void
+Record(bgfx_encoder_s *encoder, uint8_t type, uint16_t view, uint16_t handle, uint32_t num, uint64_t value) {
+	TraceEvent ev;
+	ev.type = type;
+	ev.encoder = (uint8_t)(encoder ? encoder->index : 0);
+	ev.view = view;
+	ev.handle = handle;
+	ev.num = num > UINT16_MAX ? UINT16_MAX : (uint16_t)num;
+	ev.value = value;
+	g_ctx->trace.push_back(ev);
+}
+
+static void
+ReleaseMemory(const bgfx_memory_t *mem) {
+	if (mem == nullptr)
+		return;
+	Memory *m = (Memory *)mem;
+	if (g_ctx->memories.erase(m) == 0) {
+		assert(false && "memory is used twice");
+		return;
+	}
+	if (m->release)
+		m->release(m->mem.data, m->ud);
+	if (m->owned)
+		free(m->mem.data);
+	delete m;
+}
+
+static Memory *
+NewMemory(uint8_t *data, uint32_t size, bool owned) {
+	Memory *m = new Memory;
+	m->mem.data = data;
+	m->mem.size = size;
+	m->release = nullptr;
+	m->ud = nullptr;
+	m->owned = owned;
+	g_ctx->memories.insert(m);
+	return m;
+}
+
+static bool
+IsPredefined(const char *name) {
+	for (auto p : s_predefined) {
+		if (strcmp(p, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static uint16_t
+AcquireUniform(const char *name, bgfx_uniform_type_t type, uint16_t num) {
+	auto &info = g_ctx->uniformInfo;
+	for (size_t i=0;i<info.size();i++) {
+		if (info[i].ref > 0 && info[i].name == name) {
+			++info[i].ref;
+			if (num > info[i].num)
+				info[i].num = num;
+			return (uint16_t)i;
+		}
+	}
+	uint16_t idx = g_ctx->uniforms.Alloc();
+	if (idx == UINT16_MAX)
+		return idx;
+	Resize(info, idx);
+	info[idx].name = name;
+	info[idx].type = type;
+	info[idx].num = num;
+	info[idx].ref = 1;
+	return idx;
+}
+
+static void
+ReleaseUniform(uint16_t idx) {
+	auto &u = g_ctx->uniformInfo[idx];
+	if (--u.ref == 0) {
+		u.name.clear();
+		g_ctx->uniforms.Free(idx);
+	}
+}
+
+// Read the uniform table of bgfx shader binary, returns false if it's not a valid shader.
+// see bgfx::createShader in bgfx/src/bgfx.cpp
+static bool
+ParseShader(const uint8_t *data, uint32_t size, std::vector<uint16_t> &uniforms) {
+	uint32_t offset = 0;
+	auto read = [&](void *dst, uint32_t n) {
+		if (offset + n > size)
+			return false;
+		memcpy(dst, data + offset, n);
+		offset += n;
+		return true;
+	};
+	uint32_t magic;
+	if (!read(&magic, sizeof(magic)))
+		return false;
+	uint32_t fourcc = magic & 0xffffff;
+	if (fourcc != SHADER_MAGIC_VSH && fourcc != SHADER_MAGIC_FSH && fourcc != SHADER_MAGIC_CSH)
+		return false;
+	const uint8_t version = (uint8_t)(magic >> 24);
+	uint32_t hash;
+	if (!read(&hash, sizeof(hash)))
+		return false;
+	if (version >= 6 && !read(&hash, sizeof(hash)))
+		return false;
+	uint16_t count;
+	if (!read(&count, sizeof(count)))
+		return false;
+	for (uint16_t i=0;i<count;i++) {
+		uint8_t nameSize;
+		char name[256];
+		uint8_t type;
+		uint8_t num;
+		uint16_t reg[2];
+		if (!read(&nameSize, 1) || !read(name, nameSize))
+			return false;
+		name[nameSize] = '\0';
+		if (!read(&type, 1) || !read(&num, 1) || !read(reg, sizeof(reg)))
+			return false;
+		uint16_t texInfo;
+		if (version >= 8 && !read(&texInfo, sizeof(texInfo)))
+			return false;
+		if (version >= 10 && !read(&texInfo, sizeof(texInfo)))
+			return false;
+		if (IsPredefined(name))
+			continue;
+		uint16_t idx = AcquireUniform(name, (bgfx_uniform_type_t)(type & ~SHADER_UNIFORM_MASK), num);
+		if (idx != UINT16_MAX)
+			uniforms.push_back(idx);
+	}
+	return true;
+}
+
+static uint32_t
+TransientAvail(uint32_t num, uint16_t stride) {
+	const uint32_t size = (uint32_t)g_ctx->transient.size();
+	const uint32_t start = (g_ctx->transientUsed + stride - 1) / stride * stride;
+	if (start >= size)
+		return 0;
+	const uint32_t avail = (size - start) / stride;
+	return num < avail ? num : avail;
+}
+
+static uint8_t *
+TransientAlloc(uint32_t num, uint16_t stride, uint32_t *start) {
+	*start = (g_ctx->transientUsed + stride - 1) / stride * stride;
+	assert(*start + num * stride <= g_ctx->transient.size() && "out of transient buffer");
+	g_ctx->transientUsed = *start + num * stride;
+	g_ctx->counters.transientBytes += num * stride;
+	return g_ctx->transient.data() + *start;
+}
+
+// vertex layout
+
+static bgfx_vertex_layout_t*
+vertex_layout_begin(bgfx_vertex_layout_t* _this, bgfx_renderer_type_t _rendererType) {
+	_this->hash = _rendererType;
+	_this->stride = 0;
+	memset(_this->offset, 0, sizeof(_this->offset));
+	memset(_this->attributes, 0xff, sizeof(_this->attributes));
+	return _this;
+}
+
+static bgfx_vertex_layout_t*
+vertex_layout_add(bgfx_vertex_layout_t* _this, bgfx_attrib_t _attrib, uint8_t _num, bgfx_attrib_type_t _type, bool _normalized, bool _asInt) {
+	const uint16_t encodedNorm = (_normalized & 1) << 7;
+	const uint16_t encodedType = (_type & 7) << 3;
+	const uint16_t encodedNum = (_num - 1) & 3;
+	const uint16_t encodeAsInt = (_asInt ? 1 : 0) << 8;
+	_this->attributes[_attrib] = encodedNorm | encodedType | encodedNum | encodeAsInt;
+	_this->offset[_attrib] = _this->stride;
+	_this->stride += (uint16_t)AttribSize(_type, _num);
+	return _this;
+}
+
+static void
+vertex_layout_end(bgfx_vertex_layout_t* _this) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	auto mix = [&hash](const void *p, size_t n) {
+		const uint8_t *b = (const uint8_t *)p;
+		for (size_t i=0;i<n;i++) {
+			hash = (hash ^ b[i]) * 16777619u;
+		}
+	};
+	mix(_this->attributes, sizeof(_this->attributes));
+	mix(_this->offset, sizeof(_this->offset));
+	mix(&_this->stride, sizeof(_this->stride));
+	_this->hash = hash;
+}
+
+// memory
+
+static const bgfx_memory_t*
+alloc(uint32_t _size) {
+	Lock l(g_ctx->lock);
+	return &NewMemory((uint8_t *)malloc(_size ? _size : 1), _size, true)->mem;
+}
+
+static const bgfx_memory_t*
+copy(const void* _data, uint32_t _size) {
+	Lock l(g_ctx->lock);
+	uint8_t *data = (uint8_t *)malloc(_size ? _size : 1);
+	memcpy(data, _data, _size);
+	return &NewMemory(data, _size, true)->mem;
+}
+
+static const bgfx_memory_t*
+make_ref(const void* _data, uint32_t _size) {
+	Lock l(g_ctx->lock);
+	return &NewMemory((uint8_t *)_data, _size, false)->mem;
+}
+
+static const bgfx_memory_t*
+make_ref_release(const void* _data, uint32_t _size, bgfx_release_fn_t _releaseFn, void* _userData) {
+	Lock l(g_ctx->lock);
+	Memory *m = NewMemory((uint8_t *)_data, _size, false);
+	m->release = _releaseFn;
+	m->ud = _userData;
+	return &m->mem;
+}
+
+// buffers
+
+static bgfx_index_buffer_handle_t
+create_index_buffer(const bgfx_memory_t* _mem, uint16_t _flags) {
+	Lock l(g_ctx->lock);
+	ReleaseMemory(_mem);
+	return bgfx_index_buffer_handle_t{ g_ctx->indexBuffers.Alloc() };
+}
+
+static void
+destroy_index_buffer(bgfx_index_buffer_handle_t _handle) {
+	Lock l(g_ctx->lock);
+	g_ctx->indexBuffers.Free(_handle.idx);
+}
+
+static bgfx_vertex_layout_handle_t
+create_vertex_layout(const bgfx_vertex_layout_t * _layout) {
+	Lock l(g_ctx->lock);
+	return bgfx_vertex_layout_handle_t{ g_ctx->layouts.Alloc() };
+}
+
+static void
+destroy_vertex_layout(bgfx_vertex_layout_handle_t _layoutHandle) {
+	Lock l(g_ctx->lock);
+	g_ctx->layouts.Free(_layoutHandle.idx);
+}
+
+static bgfx_vertex_buffer_handle_t
+create_vertex_buffer(const bgfx_memory_t* _mem, const bgfx_vertex_layout_t * _layout, uint16_t _flags) {
+	Lock l(g_ctx->lock);
+	assert(_layout->stride > 0 && _mem->size % _layout->stride == 0);
+	ReleaseMemory(_mem);
+	return bgfx_vertex_buffer_handle_t{ g_ctx->vertexBuffers.Alloc() };
+}
+
+static void
+destroy_vertex_buffer(bgfx_vertex_buffer_handle_t _handle) {
+	Lock l(g_ctx->lock);
+	g_ctx->vertexBuffers.Free(_handle.idx);
+}
+
+static bgfx_dynamic_vertex_buffer_handle_t
+create_dynamic_vertex_buffer(uint32_t _num, const bgfx_vertex_layout_t* _layout, uint16_t _flags) {
+	Lock l(g_ctx->lock);
+	return bgfx_dynamic_vertex_buffer_handle_t{ g_ctx->dynamicVertexBuffers.Alloc() };
+}
+
+static void
+update_dynamic_vertex_buffer(bgfx_dynamic_vertex_buffer_handle_t _handle, uint32_t _startVertex, const bgfx_memory_t* _mem) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->dynamicVertexBuffers.IsAlive(_handle.idx));
+	ReleaseMemory(_mem);
+}
+
+static void
+destroy_dynamic_vertex_buffer(bgfx_dynamic_vertex_buffer_handle_t _handle) {
+	Lock l(g_ctx->lock);
+	g_ctx->dynamicVertexBuffers.Free(_handle.idx);
+}
+
+static uint32_t
+get_avail_transient_vertex_buffer(uint32_t _num, const bgfx_vertex_layout_t * _layout) {
+	Lock l(g_ctx->lock);
+	return TransientAvail(_num, _layout->stride);
+}
+
+static uint32_t
+get_avail_instance_data_buffer(uint32_t _num, uint16_t _stride) {
+	Lock l(g_ctx->lock);
+	return TransientAvail(_num, _stride);
+}
+
+static void
+alloc_transient_vertex_buffer(bgfx_transient_vertex_buffer_t* _tvb, uint32_t _num, const bgfx_vertex_layout_t * _layout) {
+	Lock l(g_ctx->lock);
+	uint32_t start;
+	_tvb->data = TransientAlloc(_num, _layout->stride, &start);
+	_tvb->size = _num * _layout->stride;
+	_tvb->startVertex = start / _layout->stride;
+	_tvb->stride = _layout->stride;
+	_tvb->handle = bgfx_vertex_buffer_handle_t{ 0 };
+	_tvb->layoutHandle = BGFX_INVALID_HANDLE;
+}
+
+static void
+alloc_instance_data_buffer(bgfx_instance_data_buffer_t* _idb, uint32_t _num, uint16_t _stride) {
+	Lock l(g_ctx->lock);
+	uint32_t start;
+	_idb->data = TransientAlloc(_num, _stride, &start);
+	_idb->size = _num * _stride;
+	_idb->offset = start;
+	_idb->num = _num;
+	_idb->stride = _stride;
+	_idb->handle = bgfx_vertex_buffer_handle_t{ 0 };
+}
+
+// shaders, textures and uniforms
+
+static bgfx_shader_handle_t
+create_shader(const bgfx_memory_t* _mem) {
+	Lock l(g_ctx->lock);
+	std::vector<uint16_t> uniforms;
+	bool valid = ParseShader(_mem->data, _mem->size, uniforms);
+	ReleaseMemory(_mem);
+	if (!valid) {
+		for (auto u : uniforms)
+			ReleaseUniform(u);
+		return BGFX_INVALID_HANDLE;
+	}
+	uint16_t idx = g_ctx->shaders.Alloc();
+	if (idx != UINT16_MAX) {
+		Resize(g_ctx->shaderUniforms, idx);
+		g_ctx->shaderUniforms[idx] = std::move(uniforms);
+	}
+	return bgfx_shader_handle_t{ idx };
+}
+
+static uint16_t
+get_shader_uniforms(bgfx_shader_handle_t _handle, bgfx_uniform_handle_t* _uniforms, uint16_t _max) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->shaders.IsAlive(_handle.idx));
+	const auto &uniforms = g_ctx->shaderUniforms[_handle.idx];
+	if (_uniforms) {
+		for (uint16_t i=0;i<_max && i<uniforms.size();i++) {
+			_uniforms[i].idx = uniforms[i];
+		}
+	}
+	return (uint16_t)uniforms.size();
+}
+
+static void
+DestroyShader(uint16_t idx) {
+	for (auto u : g_ctx->shaderUniforms[idx])
+		ReleaseUniform(u);
+	g_ctx->shaderUniforms[idx].clear();
+	g_ctx->shaders.Free(idx);
+}
+
+static void
+destroy_shader(bgfx_shader_handle_t _handle) {
+	Lock l(g_ctx->lock);
+	DestroyShader(_handle.idx);
+}
+
+static bgfx_program_handle_t
+create_program(bgfx_shader_handle_t _vsh, bgfx_shader_handle_t _fsh, bool _destroyShaders) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->shaders.IsAlive(_vsh.idx) && g_ctx->shaders.IsAlive(_fsh.idx));
+	uint16_t idx = g_ctx->programs.Alloc();
+	if (idx != UINT16_MAX) {
+		Resize(g_ctx->programShaders, idx);
+		g_ctx->programShaders[idx].clear();
+		if (_destroyShaders) {
+			// bgfx keeps the shaders alive until the program is destroyed
+			g_ctx->programShaders[idx] = { _vsh.idx, _fsh.idx };
+		}
+	}
+	return bgfx_program_handle_t{ idx };
+}
+
+static void
+destroy_program(bgfx_program_handle_t _handle) {
+	Lock l(g_ctx->lock);
+	for (auto s : g_ctx->programShaders[_handle.idx])
+		DestroyShader(s);
+	g_ctx->programShaders[_handle.idx].clear();
+	g_ctx->programs.Free(_handle.idx);
+}
+
+static bgfx_texture_handle_t
+create_texture_2d(uint16_t _width, uint16_t _height, bool _hasMips, uint16_t _numLayers, bgfx_texture_format_t _format, uint64_t _flags, const bgfx_memory_t* _mem) {
+	Lock l(g_ctx->lock);
+	ReleaseMemory(_mem);
+	return bgfx_texture_handle_t{ g_ctx->textures.Alloc() };
+}
+
+static void
+destroy_texture(bgfx_texture_handle_t _handle) {
+	Lock l(g_ctx->lock);
+	g_ctx->textures.Free(_handle.idx);
+}
+
+static bgfx_uniform_handle_t
+create_uniform(const char* _name, bgfx_uniform_type_t _type, uint16_t _num) {
+	Lock l(g_ctx->lock);
+	return bgfx_uniform_handle_t{ AcquireUniform(_name, _type, _num) };
+}
+
+static void
+get_uniform_info(bgfx_uniform_handle_t _handle, bgfx_uniform_info_t * _info) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->uniforms.IsAlive(_handle.idx));
+	const auto &u = g_ctx->uniformInfo[_handle.idx];
+	snprintf(_info->name, sizeof(_info->name), "%s", u.name.c_str());
+	_info->type = u.type;
+	_info->num = u.num;
+}
+
+static void
+destroy_uniform(bgfx_uniform_handle_t _handle) {
+	Lock l(g_ctx->lock);
+	ReleaseUniform(_handle.idx);
+}
+
+// encoder
+
+static bgfx_encoder_t*
+encoder_begin(bool _forThread) {
+	Lock l(g_ctx->lock);
+	int i = _forThread ? 1 : 0;
+	for (; i<MOCK_MAX_ENCODERS; i++) {
+		auto &e = g_ctx->encoders[i];
+		if (!e.used) {
+			e = bgfx_encoder_s{};
+			e.index = i;
+			e.used = true;
+			return &e;
+		}
+		if (!_forThread) {
+			// bgfx returns the same encoder for the main thread
+			return &e;
+		}
+	}
+	return nullptr;
+}
+
+static void
+encoder_end(bgfx_encoder_t* _encoder) {
+	Lock l(g_ctx->lock);
+	_encoder->used = false;
+}
+
+static void
+encoder_set_state(bgfx_encoder_t* _this, uint64_t _state, uint32_t _rgba) {
+	Lock l(g_ctx->lock);
+	_this->state = _state;
+	++g_ctx->counters.states;
+	Record(_this, MOCK_TRACE_STATE, 0, 0, 0, _state);
+}
+
+static void
+encoder_set_uniform(bgfx_encoder_t* _this, bgfx_uniform_handle_t _handle, const void* _value, uint16_t _num) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->uniforms.IsAlive(_handle.idx));
+	const auto &u = g_ctx->uniformInfo[_handle.idx];
+	const uint16_t num = _num == UINT16_MAX ? u.num : _num;
+	const int bytes = num * UniformSize(u.type);
+	++g_ctx->counters.uniforms;
+	g_ctx->counters.uniformBytes += bytes;
+	Record(_this, MOCK_TRACE_UNIFORM, 0, _handle.idx, num, (uint64_t)bytes);
+}
+
+static void
+encoder_set_index_buffer(bgfx_encoder_t* _this, bgfx_index_buffer_handle_t _handle, uint32_t _firstIndex, uint32_t _numIndices) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->indexBuffers.IsAlive(_handle.idx));
+	_this->indices = _numIndices;
+}
+
+static void
+encoder_set_vertex_buffer(bgfx_encoder_t* _this, uint8_t _stream, bgfx_vertex_buffer_handle_t _handle, uint32_t _startVertex, uint32_t _numVertices) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->vertexBuffers.IsAlive(_handle.idx));
+	_this->vertices = _numVertices;
+}
+
+static void
+encoder_set_dynamic_vertex_buffer(bgfx_encoder_t* _this, uint8_t _stream, bgfx_dynamic_vertex_buffer_handle_t _handle, uint32_t _startVertex, uint32_t _numVertices) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->dynamicVertexBuffers.IsAlive(_handle.idx));
+	_this->vertices = _numVertices;
+}
+
+static void
+encoder_set_transient_vertex_buffer(bgfx_encoder_t* _this, uint8_t _stream, const bgfx_transient_vertex_buffer_t* _tvb, uint32_t _startVertex, uint32_t _numVertices) {
+	Lock l(g_ctx->lock);
+	assert(_startVertex + _numVertices <= _tvb->size / _tvb->stride);
+	_this->vertices = _numVertices;
+}
+
+static void
+encoder_set_instance_data_buffer(bgfx_encoder_t* _this, const bgfx_instance_data_buffer_t* _idb, uint32_t _start, uint32_t _num) {
+	Lock l(g_ctx->lock);
+	assert(_start + _num <= _idb->num);
+	_this->instances = _num;
+}
+
+static void
+encoder_set_instance_count(bgfx_encoder_t* _this, uint32_t _numInstances) {
+	Lock l(g_ctx->lock);
+	_this->instances = _numInstances;
+}
+
+static void
+encoder_set_texture(bgfx_encoder_t* _this, uint8_t _stage, bgfx_uniform_handle_t _sampler, bgfx_texture_handle_t _handle, uint32_t _flags) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->uniforms.IsAlive(_sampler.idx));
+	++g_ctx->counters.textures;
+	Record(_this, MOCK_TRACE_TEXTURE, _stage, _handle.idx, 0, _flags);
+}
+
+static void
+encoder_discard_(bgfx_encoder_t* _this, uint8_t _flags) {
+	if (_flags & BGFX_DISCARD_STATE)
+		_this->state = BGFX_STATE_DEFAULT;
+	if (_flags & BGFX_DISCARD_INDEX_BUFFER)
+		_this->indices = 0;
+	if (_flags & BGFX_DISCARD_VERTEX_STREAMS)
+		_this->vertices = 0;
+	if (_flags & BGFX_DISCARD_INSTANCE_DATA)
+		_this->instances = 0;
+}
+
+static void
+encoder_submit(bgfx_encoder_t* _this, bgfx_view_id_t _id, bgfx_program_handle_t _program, uint32_t _depth, uint8_t _flags) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->programs.IsAlive(_program.idx));
+	const uint32_t num = _this->instances > 0 ? _this->instances : (_this->indices > 0 ? _this->indices : _this->vertices);
+	++g_ctx->counters.submits;
+	Record(_this, MOCK_TRACE_SUBMIT, _id, _program.idx, num, _this->state);
+	encoder_discard_(_this, _flags);
+}
+
+static void
+encoder_discard(bgfx_encoder_t* _this, uint8_t _flags) {
+	Lock l(g_ctx->lock);
+	encoder_discard_(_this, _flags);
+}
+
+static void
+encoder_touch(bgfx_encoder_t* _this, bgfx_view_id_t _id) {
+}
+
+static void
+encoder_blit(bgfx_encoder_t* _this, bgfx_view_id_t _id, bgfx_texture_handle_t _dst, uint8_t _dstMip, uint16_t _dstX, uint16_t _dstY, uint16_t _dstZ, bgfx_texture_handle_t _src, uint8_t _srcMip, uint16_t _srcX, uint16_t _srcY, uint16_t _srcZ, uint16_t _width, uint16_t _height, uint16_t _depth) {
+	Lock l(g_ctx->lock);
+	assert(g_ctx->textures.IsAlive(_dst.idx));
+	++g_ctx->counters.blits;
+	Record(_this, MOCK_TRACE_BLIT, _id, _dst.idx, 0, _src.idx);
+}
+
+static const bgfx_caps_t*
+get_caps() {
+	static bgfx_caps_t caps;	// zero : homogeneousDepth is false, like Direct3D
+	return &caps;
+}
+
+static uint32_t
+frame(bool _capture) {
+	return Frame();
+}
+
+}	// namespace
+
+bgfx_interface_vtbl_t * GetInterface(uint32_t transientSize) {
+	if (g_ctx == nullptr) {
+		g_ctx = new Context;
+		auto &v = g_ctx->vtbl;
+		v.vertex_layout_begin = vertex_layout_begin;
+		v.vertex_layout_add = vertex_layout_add;
+		v.vertex_layout_end = vertex_layout_end;
+		v.frame = frame;
+		v.alloc = alloc;
+		v.copy = copy;
+		v.make_ref = make_ref;
+		v.make_ref_release = make_ref_release;
+		v.create_index_buffer = create_index_buffer;
+		v.destroy_index_buffer = destroy_index_buffer;
+		v.create_vertex_layout = create_vertex_layout;
+		v.destroy_vertex_layout = destroy_vertex_layout;
+		v.create_vertex_buffer = create_vertex_buffer;
+		v.destroy_vertex_buffer = destroy_vertex_buffer;
+		v.create_dynamic_vertex_buffer = create_dynamic_vertex_buffer;
+		v.update_dynamic_vertex_buffer = update_dynamic_vertex_buffer;
+		v.destroy_dynamic_vertex_buffer = destroy_dynamic_vertex_buffer;
+		v.get_avail_transient_vertex_buffer = get_avail_transient_vertex_buffer;
+		v.get_avail_instance_data_buffer = get_avail_instance_data_buffer;
+		v.alloc_transient_vertex_buffer = alloc_transient_vertex_buffer;
+		v.alloc_instance_data_buffer = alloc_instance_data_buffer;
+		v.create_shader = create_shader;
+		v.get_shader_uniforms = get_shader_uniforms;
+		v.destroy_shader = destroy_shader;
+		v.create_program = create_program;
+		v.destroy_program = destroy_program;
+		v.create_texture_2d = create_texture_2d;
+		v.destroy_texture = destroy_texture;
+		v.create_uniform = create_uniform;
+		v.get_uniform_info = get_uniform_info;
+		v.destroy_uniform = destroy_uniform;
+		v.encoder_begin = encoder_begin;
+		v.encoder_end = encoder_end;
+		v.encoder_set_state = encoder_set_state;
+		v.encoder_set_uniform = encoder_set_uniform;
+		v.encoder_set_index_buffer = encoder_set_index_buffer;
+		v.encoder_set_vertex_buffer = encoder_set_vertex_buffer;
+		v.encoder_set_dynamic_vertex_buffer = encoder_set_dynamic_vertex_buffer;
+		v.encoder_set_transient_vertex_buffer = encoder_set_transient_vertex_buffer;
+		v.encoder_set_instance_data_buffer = encoder_set_instance_data_buffer;
+		v.encoder_set_instance_count = encoder_set_instance_count;
+		v.encoder_set_texture = encoder_set_texture;
+		v.encoder_touch = encoder_touch;
+		v.encoder_submit = encoder_submit;
+		v.encoder_discard = encoder_discard;
+		v.encoder_blit = encoder_blit;
+		v.get_caps = get_caps;
+	}
+	Lock l(g_ctx->lock);
+	g_ctx->transient.resize(transientSize);
+	return &g_ctx->vtbl;
+}
+
+void Reset() {
+	if (g_ctx == nullptr)
+		return;
+	Lock l(g_ctx->lock);
+	for (auto m : g_ctx->memories) {
+		if (m->release)
+			m->release(m->mem.data, m->ud);
+		if (m->owned)
+			free(m->mem.data);
+		delete m;
+	}
+	g_ctx->memories.clear();
+	g_ctx->shaders.Clear();
+	g_ctx->programs.Clear();
+	g_ctx->textures.Clear();
+	g_ctx->uniforms.Clear();
+	g_ctx->vertexBuffers.Clear();
+	g_ctx->indexBuffers.Clear();
+	g_ctx->dynamicVertexBuffers.Clear();
+	g_ctx->layouts.Clear();
+	g_ctx->shaderUniforms.clear();
+	g_ctx->programShaders.clear();
+	g_ctx->uniformInfo.clear();
+	g_ctx->transientUsed = 0;
+	g_ctx->frame = 0;
+	for (auto &e : g_ctx->encoders)
+		e = bgfx_encoder_s{};
+	g_ctx->trace.clear();
+	g_ctx->counters = {};
+}
+
+uint32_t Frame() {
+	Lock l(g_ctx->lock);
+	g_ctx->transientUsed = 0;
+	g_ctx->counters.transientBytes = 0;
+	return ++g_ctx->frame;
+}
+
+const TraceEvent * GetTrace(size_t *count) {
+	Lock l(g_ctx->lock);
+	*count = g_ctx->trace.size();
+	return g_ctx->trace.data();
+}
+
+void ClearTrace() {
+	Lock l(g_ctx->lock);
+	g_ctx->trace.clear();
+	const int transientBytes = g_ctx->counters.transientBytes;
+	g_ctx->counters = {};
+	g_ctx->counters.transientBytes = transientBytes;
+}
+
+void GetCounters(Counters *counters) {
+	Lock l(g_ctx->lock);
+	*counters = g_ctx->counters;
+	counters->liveHandles = g_ctx->shaders.Alive()
+		+ g_ctx->programs.Alive()
+		+ g_ctx->textures.Alive()
+		+ g_ctx->uniforms.Alive()
+		+ g_ctx->vertexBuffers.Alive()
+		+ g_ctx->indexBuffers.Alive()
+		+ g_ctx->dynamicVertexBuffers.Alive()
+		+ g_ctx->layouts.Alive();
+}
+
+bool DumpTrace(const char *filename) {
+	static const char * name[] = { "submit", "uniform", "state", "texture", "blit" };
+	FILE *f = fopen(filename, "wb");
+	if (f == nullptr)
+		return false;
+	Lock l(g_ctx->lock);
+	for (const auto &ev : g_ctx->trace) {
+		fprintf(f, "%d %s view=%d handle=%d num=%d value=%llx\n",
+			ev.encoder, name[ev.type], ev.view, ev.handle, ev.num, (unsigned long long)ev.value);
+	}
+	fclose(f);
+	return true;
+}
+
+}	// namespace BgfxMock
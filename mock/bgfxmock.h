@@ -0,0 +1,53 @@
+#ifndef effekseer_bgfx_mock_h
+#define effekseer_bgfx_mock_h
+
+// A fake bgfx backend in memory, for running the renderer without GPU or window.
+// Pass GetInterface() as InitArgs::bgfx, the calls used by the renderer are implemented :
+// handles, vertex layouts, shaders (uniforms are read from the compiled shader binary),
+// and transient/instance buffers on heap. Submits, uniforms, states, textures and blits are recorded in a trace.
+// The other functions of the vtable are nullptr.
+
+#include <bgfx/c99/bgfx.h>
+#include <stddef.h>
+
+#define MOCK_TRACE_SUBMIT 0	// view, handle = program, num = vertices or instances, value = state
+#define MOCK_TRACE_UNIFORM 1	// handle = uniform, num = count, value = bytes
+#define MOCK_TRACE_STATE 2	// value = state
+#define MOCK_TRACE_TEXTURE 3	// view = stage, handle = texture, value = flags
+#define MOCK_TRACE_BLIT 4	// view, handle = destination, value = source
+
+namespace BgfxMock {
+	struct TraceEvent {
+		uint8_t type;
+		uint8_t encoder;	// index of the encoder, 0 is the main thread
+		uint16_t view;
+		uint16_t handle;
+		uint16_t num;
+		uint64_t value;
+	};
+
+	struct Counters {
+		int submits;
+		int uniforms;
+		int uniformBytes;
+		int states;
+		int textures;
+		int blits;
+		int transientBytes;	// transient vertex and instance data allocated in this frame
+		int liveHandles;	// all kinds of handles not destroyed
+	};
+
+	// transientSize is the size of transient vertex buffer per frame (instance data buffers use it too)
+	bgfx_interface_vtbl_t * GetInterface(uint32_t transientSize = 6 << 20);
+	// Destroy all the handles, and clear the trace. Call it after the renderer is released.
+	void Reset();
+	// Same as bgfx_frame, the transient buffers are released.
+	uint32_t Frame();
+	const TraceEvent * GetTrace(size_t *count);
+	void ClearTrace();
+	void GetCounters(Counters *counters);
+	// Write the trace as text, one event per line. Returns false if the file can't be opened.
+	bool DumpTrace(const char *filename);
+}
+
+#endif
@@ -0,0 +1,35 @@
+local lm = require "luamake"
+
+package.path = "./?.lua;../?.lua"
+
+require "buildscripts.common"
+
+lm.builddir = lm.builddir or ("build/%s/%s"):format(Plat, lm.mode)
+lm.bindir   = lm.bindir or ("bin/%s/%s"):format(Plat, lm.mode)
+
+lm:lib "efkbgfx_mock" {
+    includes = EfkLib_Includes,
+    sources = {
+        "bgfxmock.cpp",
+    },
+}
+
+--------------------------smoketest
+-- Run it in `mock` dir, after the shader binaries are built (See examples/make.lua)
+lm:exe "smoketest" {
+    deps = {
+        "efklib",
+        "source_efkbgfx_lib",
+        "efkbgfx_mock",
+    },
+    includes = {
+        EfkLib_Includes,
+        "../",
+    },
+    sources = {
+        "smoketest.cpp",
+    },
+    defines = {
+        "BX_CONFIG_DEBUG=" .. (lm.mode == "debug" and 1 or 0),
+    },
+}
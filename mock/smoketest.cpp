@@ -0,0 +1,341 @@
+// Smoke test of the renderer on the mock backend (See bgfxmock.h), no GPU or window.
+//
+// smoketest [-update] [effect ...]
+//
+// Run it in `mock` dir, the shaders are loaded from `../shaders` (build them by examples/make.lua first),
+// and the effects are `../examples/resources/Laser01.efk` and `Simple_Model_UV.efkefc` by default.
+// Each effect is played for some frames twice, with sequentialView on and off, and it checks that :
+//   the submits, uniforms, states and textures recorded by the mock equal the sums of FrameStats,
+//   both runs submit the same draw calls, states and textures, and the uniforms skipped by the cache are the difference,
+//   the counters equal the baseline in smoketest.expected (write it by -update),
+//   and all the handles are destroyed after the renderer is released.
+
+#include "bgfxmock.h"
+#include "renderer/bgfxrenderer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); return false; } } while(0)
+
+namespace
+{
+
+static const bgfx_view_id_t g_viewId = 0;
+static const float g_width = 1280;
+static const float g_height = 720;
+static const int g_frames = 60;
+static const char *g_baseline = "smoketest.expected";
+
+static bgfx_interface_vtbl_t *g_bgfx = nullptr;
+
+static bool
+readFile(const char *filename, std::vector<uint8_t> &data) {
+	FILE *f = fopen(filename, "rb");
+	if (f == nullptr)
+		return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data.resize(size);
+	const bool ok = fread(data.data(), 1, size, f) == (size_t)size;
+	fclose(f);
+	return ok;
+}
+
+static const char*
+findShaderFile(const char* name, const char* type){
+	static const struct {
+		const char *name;
+		const char *vs;
+		const char *fs;
+	} shaders[] = {
+		{ "sprite_unlit", 			"../shaders/sprite_unlit_vs.fx.bin", 		"../shaders/model_unlit_ps.fx.bin" },
+		{ "sprite_lit", 			"../shaders/sprite_lit_vs.fx.bin", 			"../shaders/model_lit_ps.fx.bin" },
+		{ "sprite_distortion", 		"../shaders/sprite_distortion_vs.fx.bin", 	"../shaders/model_distortion_ps.fx.bin" },
+		{ "sprite_adv_unlit", 		"../shaders/ad_sprite_unlit_vs.fx.bin", 	"../shaders/ad_model_unlit_ps.fx.bin" },
+		{ "sprite_adv_lit", 		"../shaders/ad_sprite_lit_vs.fx.bin", 		"../shaders/ad_model_lit_ps.fx.bin" },
+		{ "sprite_adv_distortion", 	"../shaders/ad_sprite_distortion_vs.fx.bin","../shaders/ad_model_distortion_ps.fx.bin" },
+		{ "model_unlit", 			"../shaders/model_unlit_vs.fx.bin", 		"../shaders/model_unlit_ps.fx.bin" },
+		{ "model_lit", 				"../shaders/model_lit_vs.fx.bin", 			"../shaders/model_lit_ps.fx.bin" },
+		{ "model_distortion", 		"../shaders/model_distortion_vs.fx.bin", 	"../shaders/model_distortion_ps.fx.bin" },
+		{ "model_adv_unlit", 		"../shaders/ad_model_unlit_vs.fx.bin", 		"../shaders/ad_model_unlit_ps.fx.bin" },
+		{ "model_adv_lit", 			"../shaders/ad_model_lit_vs.fx.bin", 		"../shaders/ad_model_lit_ps.fx.bin" },
+		{ "model_adv_distortion", 	"../shaders/ad_model_distortion_vs.fx.bin", "../shaders/ad_model_distortion_ps.fx.bin" },
+		{ "model_unlit_inst", 		"../shaders/modelinst_unlit_vs.fx.bin", 	"../shaders/model_unlit_ps.fx.bin" },
+		{ "model_lit_inst", 		"../shaders/modelinst_lit_vs.fx.bin", 		"../shaders/model_lit_ps.fx.bin" },
+		{ "model_distortion_inst", 	"../shaders/modelinst_distortion_vs.fx.bin","../shaders/model_distortion_ps.fx.bin" },
+	};
+	for (const auto &s : shaders) {
+		if (strcmp(name, s.name) == 0)
+			return strcmp(type, "vs") == 0 ? s.vs : s.fs;
+	}
+	return nullptr;
+}
+
+static bgfx_shader_handle_t ShaderLoad(const char *mat, const char *name, const char *type, void *ud){
+	const char* shaderfile = mat ? nullptr : findShaderFile(name, type);
+	std::vector<uint8_t> data;
+	if (shaderfile == nullptr || !readFile(shaderfile, data))
+		return bgfx_shader_handle_t{ UINT16_MAX };
+	return g_bgfx->create_shader(g_bgfx->copy(data.data(), (uint32_t)data.size()));
+}
+
+// The textures are not loaded, the renderer only needs valid handles.
+static bgfx_texture_handle_t createWhiteTexture() {
+	static const uint32_t white = 0xffffffff;
+	return g_bgfx->create_texture_2d(1, 1, false, 1, BGFX_TEXTURE_FORMAT_RGBA8, BGFX_SAMPLER_NONE, g_bgfx->copy(&white, sizeof(white)));
+}
+
+static bgfx_texture_handle_t g_white = { UINT16_MAX };
+
+static bgfx_texture_handle_t TextureGet(int texture_type, void *parm, void *ud){
+	if (texture_type == TEXTURE_DEPTH){
+		EffekseerRenderer::DepthReconstructionParameter *p = (EffekseerRenderer::DepthReconstructionParameter*)parm;
+		p->DepthBufferScale = 1.0f;
+		p->DepthBufferOffset = 0.0f;
+		p->ProjectionMatrix33 = 1.0f;
+		p->ProjectionMatrix34 = 1.0f;
+		p->ProjectionMatrix43 = 0.0f;
+		p->ProjectionMatrix44 = 0.0f;
+	}
+	return g_white;
+}
+
+static int TextureLoad(const char *name, int srgb, void *ud){
+	auto handle = createWhiteTexture();
+	if (handle.idx == UINT16_MAX)
+		return -1;
+	return handle.idx;
+}
+
+static void TextureUnload(int id, void *ud){
+	g_bgfx->destroy_texture(bgfx_texture_handle_t{uint16_t(id & 0xffff)});
+}
+
+static bgfx_texture_handle_t TextureHandle(int id, void *ud) {
+	bgfx_texture_handle_t ret { uint16_t(id & 0xffff) };
+	return ret;
+}
+
+struct Counts {
+	BgfxMock::Counters mock;
+	EffekseerRendererBGFX::FrameStats sum;	// FrameStats of all the frames
+};
+
+static void addStats(EffekseerRendererBGFX::FrameStats &sum, const EffekseerRendererBGFX::FrameStats &s) {
+	sum.drawCalls += s.drawCalls;
+	sum.uniformSubmits += s.uniformSubmits;
+	sum.uniformSkips += s.uniformSkips;
+	sum.textureBinds += s.textureBinds;
+	sum.stateChanges += s.stateChanges;
+}
+
+static bool render(const char *filename, bool sequentialView, Counts &counts) {
+	EffekseerRendererBGFX::InitArgs efkArgs {
+		2048, g_viewId, g_bgfx,
+		ShaderLoad,
+		TextureGet,
+		TextureLoad,
+		TextureUnload,
+		TextureHandle,
+		nullptr,
+		false,
+		sequentialView,
+	};
+	auto renderer = EffekseerRendererBGFX::CreateRenderer(&efkArgs);
+	CHECK(renderer != nullptr);
+	auto manager = Effekseer::Manager::Create(2000);
+	manager->GetSetting()->SetCoordinateSystem(Effekseer::CoordinateSystem::LH);
+	manager->SetModelRenderer(EffekseerRendererBGFX::CreateModelRenderer(renderer, &efkArgs));
+	manager->SetSpriteRenderer(renderer->CreateSpriteRenderer());
+	manager->SetRibbonRenderer(renderer->CreateRibbonRenderer());
+	manager->SetRingRenderer(renderer->CreateRingRenderer());
+	manager->SetTrackRenderer(renderer->CreateTrackRenderer());
+	manager->SetTextureLoader(renderer->CreateTextureLoader());
+	manager->SetModelLoader(renderer->CreateModelLoader());
+	manager->SetMaterialLoader(renderer->CreateMaterialLoader());
+	manager->SetCurveLoader(Effekseer::MakeRefPtr<Effekseer::CurveLoader>());
+
+	Effekseer::Matrix44 projMat, viewMat;
+	projMat.PerspectiveFovLH(90.0f / 180.0f * 3.14159265f, g_width/g_height, 1.0f, 500.0f);
+	viewMat.LookAtLH(Effekseer::Vector3D(0.0f, 0.0f, 40.0f), Effekseer::Vector3D(0.0f, 0.0f, 0.0f), Effekseer::Vector3D(0.0f, 1.0f, 0.0f));
+	renderer->SetProjectionMatrix(projMat);
+	renderer->SetCameraMatrix(viewMat);
+
+	char16_t path[1024];
+	Effekseer::ConvertUtf8ToUtf16(path, 1024, filename);
+	auto effect = Effekseer::Effect::Create(manager, path);
+	CHECK(effect != nullptr);
+	// The same seed for both runs, so they draw the same particles
+	auto play = [&]() {
+		auto handle = manager->Play(effect, 0.0f, 0.0f, 0.0f);
+		manager->SetRandomSeed(handle, 1);
+		return handle;
+	};
+	auto handle = play();
+
+	BgfxMock::ClearTrace();
+	counts.sum = {};
+	for (int f=0;f<g_frames;f++) {
+		if (!manager->Exists(handle))
+			handle = play();
+		manager->Update();
+		renderer->BeginRendering();
+		Effekseer::Manager::DrawParameter drawParameter;
+		drawParameter.ZNear = 0.0f;
+		drawParameter.ZFar = 1.0f;
+		drawParameter.ViewProjectionMatrix = renderer->GetCameraProjectionMatrix();
+		manager->Draw(drawParameter);
+		renderer->EndRendering();
+		EffekseerRendererBGFX::FrameStats stats;
+		EffekseerRendererBGFX::GetFrameStats(renderer, &stats);
+		addStats(counts.sum, stats);
+		BgfxMock::Frame();
+		EffekseerRendererBGFX::NextFrame(renderer);
+	}
+	BgfxMock::GetCounters(&counts.mock);
+
+	manager->StopAllEffects();
+	manager->Update();
+	effect = nullptr;
+	manager = nullptr;
+	renderer = nullptr;
+	return true;
+}
+
+// effect -> "submits uniforms states textures" with sequentialView on
+typedef std::map<std::string, std::string> Baseline;
+
+static std::string baselineLine(const Counts &c) {
+	char line[128];
+	snprintf(line, sizeof(line), "%d %d %d %d", c.mock.submits, c.mock.uniforms, c.mock.states, c.mock.textures);
+	return line;
+}
+
+static void readBaseline(Baseline &baseline) {
+	FILE *f = fopen(g_baseline, "rb");
+	if (f == nullptr)
+		return;
+	char name[1024], line[128];
+	int submits, uniforms, states, textures;
+	while (fscanf(f, "%1023s %d %d %d %d", name, &submits, &uniforms, &states, &textures) == 5) {
+		snprintf(line, sizeof(line), "%d %d %d %d", submits, uniforms, states, textures);
+		baseline[name] = line;
+	}
+	fclose(f);
+}
+
+static bool writeBaseline(const Baseline &baseline) {
+	FILE *f = fopen(g_baseline, "wb");
+	if (f == nullptr)
+		return false;
+	for (auto &it : baseline) {
+		fprintf(f, "%s %s\n", it.first.c_str(), it.second.c_str());
+	}
+	fclose(f);
+	return true;
+}
+
+// The counters of the mock are exactly what the renderer reports
+static bool checkStats(const Counts &c) {
+	CHECK(c.mock.submits > 0);
+	CHECK(c.mock.submits == c.sum.drawCalls);
+	CHECK(c.mock.uniforms == c.sum.uniformSubmits);
+	CHECK(c.mock.states == c.sum.stateChanges);
+	CHECK(c.mock.textures == c.sum.textureBinds);
+	return true;
+}
+
+static bool run(const char *filename, bool update, Baseline &baseline) {
+	Counts cached, uncached;
+	if (!render(filename, true, cached) || !render(filename, false, uncached))
+		return false;
+	if (!checkStats(cached) || !checkStats(uncached))
+		return false;
+	// The uniform cache only skips encoder_set_uniform
+	CHECK(uncached.sum.uniformSkips == 0);
+	CHECK(cached.mock.submits == uncached.mock.submits);
+	CHECK(cached.mock.states == uncached.mock.states);
+	CHECK(cached.mock.textures == uncached.mock.textures);
+	CHECK(uncached.mock.uniforms == cached.sum.uniformSubmits + cached.sum.uniformSkips);
+
+	const std::string line = baselineLine(cached);
+	if (update) {
+		baseline[filename] = line;
+	} else {
+		auto it = baseline.find(filename);
+		if (it == baseline.end()) {
+			printf("No baseline : %s (run with -update)\n", filename);
+		} else if (it->second != line) {
+			fprintf(stderr, "Expected (submits uniforms states textures) : %s, got : %s\n", it->second.c_str(), line.c_str());
+			return false;
+		}
+	}
+
+	BgfxMock::Counters counters;
+	BgfxMock::GetCounters(&counters);
+	CHECK(counters.liveHandles == 1);	// g_white
+	return true;
+}
+
+static bool init() {
+	g_bgfx = BgfxMock::GetInterface();
+	g_white = createWhiteTexture();
+	CHECK(g_white.idx != UINT16_MAX);
+	return true;
+}
+
+static bool shutdown() {
+	g_bgfx->destroy_texture(g_white);
+	BgfxMock::Counters counters;
+	BgfxMock::GetCounters(&counters);
+	CHECK(counters.liveHandles == 0);
+	BgfxMock::Reset();
+	BgfxMock::GetCounters(&counters);
+	CHECK(counters.liveHandles == 0);
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	bool update = false;
+	std::vector<const char *> effects;
+	for (int i=1;i<argc;i++) {
+		if (strcmp(argv[i], "-update") == 0)
+			update = true;
+		else
+			effects.push_back(argv[i]);
+	}
+	if (effects.empty()) {
+		effects = {
+			"../examples/resources/Laser01.efk",
+			"../examples/resources/Simple_Model_UV.efkefc",
+		};
+	}
+	if (!init())
+		return 1;
+	Baseline baseline;
+	readBaseline(baseline);
+	int failed = 0;
+	for (auto filename : effects) {
+		if (run(filename, update, baseline)) {
+			printf("OK : %s\n", filename);
+		} else {
+			fprintf(stderr, "FAILED : %s\n", filename);
+			++failed;
+		}
+	}
+	if (update && !writeBaseline(baseline)) {
+		fprintf(stderr, "Can't write %s\n", g_baseline);
+		++failed;
+	}
+	if (!shutdown())
+		++failed;
+	return failed == 0 ? 0 : 1;
+}
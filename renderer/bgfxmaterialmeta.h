@@ -0,0 +1,244 @@
+#ifndef effekseer_bgfx_material_meta_h
+#define effekseer_bgfx_material_meta_h
+
+// The sidecar of a user defined material (.efkmat.meta), generated by efkmatc (efkmat.meta).
+// It has everything MaterialLoader needs : flags, uniform offsets and the names of uniforms and textures,
+// so the renderer doesn't parse the .efkmat file at runtime.
+// It records the size and the hash of the .efkmat, the renderer ignores it if the .efkmat is changed.
+//
+// Layout (native endian) :
+//	MaterialMeta
+//	MaterialMetaTexture[textureCount]
+//	uint16_t[uniformCount] : offsets of the uniform names in the string table
+//	string table : zero terminated names
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <Effekseer/Material/Effekseer.MaterialFile.h>
+#include <EffekseerRendererCommon/EffekseerRenderer.CommonUtils.h>
+
+#define MATERIAL_META_MAGIC 0x4154454d	// "META"
+#define MATERIAL_META_VERSION 3
+// sprite, sprite_refraction, model, model_refraction
+#define MATERIAL_META_SHADERS 4
+// Instance count of the model shaders, same as MaxInstanced in bgfxrenderer.cpp
+#define MATERIAL_META_INSTANCES 20
+// Sampler slots of a shader, same as Shader::maxSamplers in bgfxrenderer.cpp
+#define MATERIAL_META_MAX_SAMPLERS 8
+
+// Offsets of predefined uniforms in MaterialMetaShader
+#define MATERIAL_META_VS_CAMERA 0
+#define MATERIAL_META_VS_PROJECTION 1
+#define MATERIAL_META_VS_UVINVERSED 2
+#define MATERIAL_META_VS_PREDEFINED 3
+#define MATERIAL_META_VS_CAMERAPOSITION 4
+#define MATERIAL_META_VS_CUSTOMDATA1 5
+#define MATERIAL_META_VS_CUSTOMDATA2 6
+// the arrays of model shaders, for instancing
+#define MATERIAL_META_VS_MODELMATRIX 7
+#define MATERIAL_META_VS_MODELUV 8
+#define MATERIAL_META_VS_MODELCOLOR 9
+#define MATERIAL_META_VS_COUNT 10
+
+#define MATERIAL_META_PS_UVINVERSEDBACK 0
+#define MATERIAL_META_PS_PREDEFINED 1
+#define MATERIAL_META_PS_CAMERAPOSITION 2
+#define MATERIAL_META_PS_RECONSTRUCTION1 3
+#define MATERIAL_META_PS_RECONSTRUCTION2 4
+#define MATERIAL_META_PS_LIGHTDIRECTION 5
+#define MATERIAL_META_PS_LIGHTCOLOR 6
+#define MATERIAL_META_PS_LIGHTAMBIENT 7
+#define MATERIAL_META_PS_CAMERAMATRIX 8
+#define MATERIAL_META_PS_COUNT 9
+
+namespace EffekseerRendererBGFX {
+	struct MaterialMetaShader {
+		int32_t vsSize;
+		int32_t psSize;
+		int32_t vs[MATERIAL_META_VS_COUNT];
+		int32_t vsUser;	// offset of the first user uniform
+		int32_t ps[MATERIAL_META_PS_COUNT];
+		int32_t psUser;
+	};
+
+	struct MaterialMetaTexture {
+		int32_t index;
+		uint16_t name;	// offset in string table
+		uint8_t wrap;	// Effekseer::TextureWrapType
+		uint8_t colorType;	// Effekseer::TextureColorType
+	};
+
+	struct MaterialMeta {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t guid;
+		uint8_t shadingModel;	// Effekseer::ShadingModelType
+		uint8_t simpleVertex;
+		uint8_t refraction;
+		uint8_t customData1;
+		uint8_t customData2;
+		uint8_t textureCount;
+		uint8_t uniformCount;
+		uint8_t instances;	// MATERIAL_META_INSTANCES
+		uint32_t size;	// size of the whole file
+		uint32_t sourceSize;	// size of the .efkmat
+		uint32_t sourceHash;	// FNV-1a of the .efkmat, See SourceHash()
+		MaterialMetaShader shader[MATERIAL_META_SHADERS];
+	};
+
+	// MaterialMeta with the names, loaded from Effekseer::MaterialFile or the sidecar.
+	// The names point to the material file or the sidecar data, so keep them alive while using it.
+	struct MaterialDesc {
+		MaterialMeta meta;
+		std::vector<MaterialMetaTexture> textures;
+		std::vector<const char *> textureNames;
+		std::vector<const char *> uniformNames;
+
+		static uint32_t SourceHash(const void *source, size_t size) {
+			const uint8_t *p = (const uint8_t *)source;
+			uint32_t h = 2166136261u;
+			for (size_t i = 0; i < size; i++) {
+				h ^= p[i];
+				h *= 16777619u;
+			}
+			return h;
+		}
+		// mat is loaded from source
+		bool Load(const Effekseer::MaterialFile &mat, const void *source, size_t sourceSize) {
+			memset(&meta, 0, sizeof(meta));
+			meta.magic = MATERIAL_META_MAGIC;
+			meta.version = MATERIAL_META_VERSION;
+			meta.sourceSize = (uint32_t)sourceSize;
+			meta.sourceHash = SourceHash(source, sourceSize);
+			meta.guid = mat.GetGUID();
+			meta.shadingModel = (uint8_t)mat.GetShadingModel();
+			meta.simpleVertex = mat.GetIsSimpleVertex();
+			meta.refraction = mat.GetHasRefraction();
+			meta.customData1 = (uint8_t)mat.GetCustomData1Count();
+			meta.customData2 = (uint8_t)mat.GetCustomData2Count();
+			meta.textureCount = (uint8_t)mat.GetTextureCount();
+			meta.uniformCount = (uint8_t)mat.GetUniformCount();
+			meta.instances = MATERIAL_META_INSTANCES;
+			for (int kind = 0; kind < MATERIAL_META_SHADERS; kind++) {
+				const bool isModel = kind >= 2;
+				const int st = kind & 1;
+				if (st == 1 && !meta.refraction)
+					continue;
+				auto g = EffekseerRenderer::MaterialShaderParameterGenerator(mat, isModel, st, isModel ? MATERIAL_META_INSTANCES : 1);
+				MaterialMetaShader &s = meta.shader[kind];
+				s.vsSize = g.VertexShaderUniformBufferSize;
+				s.psSize = g.PixelShaderUniformBufferSize;
+				s.vs[MATERIAL_META_VS_CAMERA] = g.VertexCameraMatrixOffset;
+				s.vs[MATERIAL_META_VS_PROJECTION] = g.VertexProjectionMatrixOffset;
+				s.vs[MATERIAL_META_VS_UVINVERSED] = g.VertexInversedFlagOffset;
+				s.vs[MATERIAL_META_VS_PREDEFINED] = g.VertexPredefinedOffset;
+				s.vs[MATERIAL_META_VS_CAMERAPOSITION] = g.VertexCameraPositionOffset;
+				s.vs[MATERIAL_META_VS_CUSTOMDATA1] = g.VertexModelCustomData1Offset;
+				s.vs[MATERIAL_META_VS_CUSTOMDATA2] = g.VertexModelCustomData2Offset;
+				s.vs[MATERIAL_META_VS_MODELMATRIX] = g.VertexModelMatrixOffset;
+				s.vs[MATERIAL_META_VS_MODELUV] = g.VertexModelUVOffset;
+				s.vs[MATERIAL_META_VS_MODELCOLOR] = g.VertexModelColorOffset;
+				s.vsUser = g.VertexUserUniformOffset;
+				s.ps[MATERIAL_META_PS_UVINVERSEDBACK] = g.PixelInversedFlagOffset;
+				s.ps[MATERIAL_META_PS_PREDEFINED] = g.PixelPredefinedOffset;
+				s.ps[MATERIAL_META_PS_CAMERAPOSITION] = g.PixelCameraPositionOffset;
+				s.ps[MATERIAL_META_PS_RECONSTRUCTION1] = g.PixelReconstructionParam1Offset;
+				s.ps[MATERIAL_META_PS_RECONSTRUCTION2] = g.PixelReconstructionParam2Offset;
+				s.ps[MATERIAL_META_PS_LIGHTDIRECTION] = g.PixelLightDirectionOffset;
+				s.ps[MATERIAL_META_PS_LIGHTCOLOR] = g.PixelLightColorOffset;
+				s.ps[MATERIAL_META_PS_LIGHTAMBIENT] = g.PixelLightAmbientColorOffset;
+				s.ps[MATERIAL_META_PS_CAMERAMATRIX] = g.PixelCameraMatrixOffset;
+				s.psUser = g.PixelUserUniformOffset;
+			}
+			textures.resize(meta.textureCount);
+			textureNames.resize(meta.textureCount);
+			for (int i = 0; i < meta.textureCount; i++) {
+				textures[i].index = mat.GetTextureIndex(i);
+				textures[i].name = 0;	// set by Save
+				textures[i].wrap = (uint8_t)mat.GetTextureWrap(i);
+				textures[i].colorType = (uint8_t)mat.GetTextureColorType(i);
+				textureNames[i] = mat.GetTextureName(i);
+			}
+			uniformNames.resize(meta.uniformCount);
+			for (int i = 0; i < meta.uniformCount; i++) {
+				uniformNames[i] = mat.GetUniformName(i);
+			}
+			return true;
+		}
+		// Returns false if data is not a valid sidecar of this version
+		bool Load(const void *data, size_t size) {
+			const uint8_t *p = (const uint8_t *)data;
+			if (size < sizeof(meta))
+				return false;
+			memcpy(&meta, p, sizeof(meta));
+			if (meta.magic != MATERIAL_META_MAGIC
+				|| meta.version != MATERIAL_META_VERSION
+				|| meta.instances != MATERIAL_META_INSTANCES
+				|| meta.size != size)
+				return false;
+			size_t offset = sizeof(meta);
+			const size_t strings = offset + meta.textureCount * sizeof(MaterialMetaTexture) + meta.uniformCount * sizeof(uint16_t);
+			if (strings >= size || p[size-1] != '\0')
+				return false;
+			const char *table = (const char *)(p + strings);
+			const size_t tableSize = size - strings;
+			textures.resize(meta.textureCount);
+			textureNames.resize(meta.textureCount);
+			for (int i = 0; i < meta.textureCount; i++) {
+				memcpy(&textures[i], p + offset, sizeof(MaterialMetaTexture));
+				offset += sizeof(MaterialMetaTexture);
+				if (textures[i].name >= tableSize
+					|| textures[i].index < 0 || textures[i].index >= MATERIAL_META_MAX_SAMPLERS - 2)	// efk_background and efk_depth follow them
+					return false;
+				textureNames[i] = table + textures[i].name;
+			}
+			uniformNames.resize(meta.uniformCount);
+			for (int i = 0; i < meta.uniformCount; i++) {
+				uint16_t name;
+				memcpy(&name, p + offset, sizeof(name));
+				offset += sizeof(name);
+				if (name >= tableSize)
+					return false;
+				uniformNames[i] = table + name;
+			}
+			return true;
+		}
+		// Returns true if the sidecar is generated from this .efkmat
+		bool Match(const void *source, size_t sourceSize) const {
+			return meta.sourceSize == sourceSize && meta.sourceHash == SourceHash(source, sourceSize);
+		}
+		// Serialize to the sidecar format
+		std::string Save() const {
+			std::string table;
+			auto addName = [&table](const char *name) {
+				uint16_t offset = (uint16_t)table.size();
+				table.append(name);
+				table.push_back('\0');
+				return offset;
+			};
+			std::vector<MaterialMetaTexture> tex(textures);
+			for (size_t i = 0; i < tex.size(); i++) {
+				tex[i].name = addName(textureNames[i]);
+			}
+			std::vector<uint16_t> uniforms(uniformNames.size());
+			for (size_t i = 0; i < uniforms.size(); i++) {
+				uniforms[i] = addName(uniformNames[i]);
+			}
+			if (table.empty())
+				table.push_back('\0');
+			MaterialMeta m = meta;
+			m.size = (uint32_t)(sizeof(m) + tex.size() * sizeof(MaterialMetaTexture) + uniforms.size() * sizeof(uint16_t) + table.size());
+			std::string ret;
+			ret.reserve(m.size);
+			ret.append((const char *)&m, sizeof(m));
+			ret.append((const char *)tex.data(), tex.size() * sizeof(MaterialMetaTexture));
+			ret.append((const char *)uniforms.data(), uniforms.size() * sizeof(uint16_t));
+			ret.append(table);
+			return ret;
+		}
+	};
+}
+
+#endif
@@ -1,6 +1,12 @@
 #include <cstdint>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <EffekseerRendererCommon/EffekseerRenderer.IndexBufferBase.h>
 #include <EffekseerRendererCommon/EffekseerRenderer.VertexBufferBase.h>
 #include <EffekseerRendererCommon/EffekseerRenderer.ShaderBase.h>
@@ -11,24 +17,125 @@
 #include <EffekseerRendererCommon/EffekseerRenderer.SpriteRendererBase.h>
 #include <EffekseerRendererCommon/EffekseerRenderer.TrackRendererBase.h>
 #include <EffekseerRendererCommon/EffekseerRenderer.ModelRendererBase.h>
-#include <EffekseerRendererCommon/ModelLoader.h>
 #include "bgfxrenderer.h"
+#include "bgfxmaterialmeta.h"
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#	undef MAX_PATH
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
 
 #define BGFX(api) m_bgfx->api
 
 #define MAX_PATH 2048
 #define MaxInstanced 20
+#define MAX_CLONES 256
+#define MATERIAL_SHADER_KIND 4
+#define TRANSIENT_MIN_VERTICES 256
+#define RING_FRAMES 3
+// Keep the render state after submit, see SetCurrentState
+#define SUBMIT_DISCARD (BGFX_DISCARD_ALL & ~BGFX_DISCARD_STATE)
+// Size of the texture table (same as BGFX_CONFIG_MAX_TEXTURES), larger ids are translated by texture_handle callback
+#define MAX_TEXTURE_ID 4096
+// Instance data of model : 3 rows of model matrix, uv, color
+#define MODEL_INSTANCE_STRIDE (5 * 4 * sizeof(float))
 
 #define LAYOUT_LIGHTING 0
 #define LAYOUT_SIMPLE 1
 #define LAYOUT_ADVLIGHTING 2
 #define LAYOUT_ADVSIMPLE 3
 #define LAYOUT_MATERIAL 4
-#define LAYOUT_COUNT 5
+// simple vertex + complex vertex with CustomData1/CustomData2 counts in [0, 4]
+#define LAYOUT_MATERIAL_CUSTOMDATA 5
+#define LAYOUT_MATERIAL_COUNT (1 + LAYOUT_MATERIAL_CUSTOMDATA * LAYOUT_MATERIAL_CUSTOMDATA)
+#define LAYOUT_COUNT (LAYOUT_MATERIAL + LAYOUT_MATERIAL_COUNT)
 
 namespace EffekseerRendererBGFX {
 
 static const int SHADERCOUNT = (int)EffekseerRenderer::RendererShaderType::Material;
+static_assert(MaxInstanced == MATERIAL_META_INSTANCES, "The uniform offsets in material sidecar depend on MaxInstanced");
+
+// Read only memory mapped file, See MappedFile::Open
+class MappedFile {
+private:
+	void *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	HANDLE m_mapping = nullptr;
+#endif
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+	~MappedFile() {
+		Close();
+	}
+	bool Open(const char16_t *path);
+	void Close();
+	const void * Data() const {
+		return m_data;
+	}
+	size_t Size() const {
+		return m_size;
+	}
+};
+
+// Read a file by the load callback (model_load/material_load), or map it, or read it by the FileInterface of the Manager.
+class FileReader {
+private:
+	Effekseer::FileInterfaceRef m_file;
+	void *m_ud;
+	const void * (*m_loader)(const char *name, size_t *size, void *ud);
+	void (*m_unloader)(const void *data, size_t size, void *ud);
+public:
+	FileReader(Effekseer::FileInterfaceRef f, void *ud,
+		const void * (*loader)(const char *name, size_t *size, void *ud),
+		void (*unloader)(const void *data, size_t size, void *ud))
+		: m_file(f), m_ud(ud), m_loader(loader), m_unloader(unloader) {}
+	// The data is only valid in func, and func isn't called if the file can't be read.
+	template<typename F>
+	void Read(const char16_t *path, F func) const {
+		if (m_loader != nullptr) {
+			char name[MAX_PATH];
+			Effekseer::ConvertUtf16ToUtf8(name, MAX_PATH, path);
+			size_t size = 0;
+			const void *data = m_loader(name, &size, m_ud);
+			if (data == nullptr)
+				return;
+			func(data, size);
+			if (m_unloader != nullptr)
+				m_unloader(data, size, m_ud);
+			return;
+		}
+		if (m_file == nullptr) {
+			MappedFile file;
+			if (file.Open(path)) {
+				func(file.Data(), file.Size());
+				return;
+			}
+		}
+		// The FileInterface of the Manager, or the default one if the file can't be mapped
+		Effekseer::FileInterfaceRef f = m_file;
+		if (f == nullptr)
+			f = Effekseer::MakeRefPtr<Effekseer::DefaultFileInterface>();
+		auto reader = f->OpenRead(path);
+		if (reader == nullptr)
+			return;
+
+		size_t size = reader->GetLength();
+		std::vector<char> data;
+		data.resize(size);
+		reader->Read(data.data(), size);
+		func(data.data(), size);
+	}
+};
 
 // Renderer
 
@@ -58,18 +165,46 @@ class Texture : public Effekseer::Backend::Texture {
 private:
 	const RendererImplemented *m_render;
 	bgfx_texture_handle_t m_handle;
-	int m_id;
+	// The id (low 32 bits) and the generation of the id in texture table when it's loaded (high 32 bits).
+	// Packed together, because a reload may change them while the worker renderers read them.
+	std::atomic<uint64_t> m_binding;
+	std::atomic<uint32_t> m_lastUsed;	// frame number, See NextFrame()
+	std::atomic<bool> m_evicted;	// unloaded for the texture budget, and it will be loaded again when it's used
+	static uint64_t Binding(int id, uint32_t generation) {
+		return (uint64_t)generation << 32 | (uint32_t)id;
+	}
 public:
-	Texture(const RendererImplemented *render, bgfx_texture_handle_t handle) : m_render(render), m_handle(handle), m_id(-1) {}
-	Texture(const RendererImplemented *render, int id) : m_render(render), m_id(id) { m_handle.idx = UINT16_MAX; }
+	Texture(const RendererImplemented *render, bgfx_texture_handle_t handle) : m_render(render), m_handle(handle), m_binding(Binding(-1, 0)), m_lastUsed(0), m_evicted(false) {}
+	Texture(const RendererImplemented *render, int id, uint32_t generation) : m_render(render), m_binding(Binding(id, generation)), m_lastUsed(0), m_evicted(false) { m_handle.idx = UINT16_MAX; }
 	~Texture() override;
 	int GetId() const {
-		return m_id;
+		return (int)(uint32_t)m_binding.load(std::memory_order_acquire);
+	}
+	// Returns the id, and the generation of the same load
+	int GetId(uint32_t *generation) const {
+		const uint64_t binding = m_binding.load(std::memory_order_acquire);
+		*generation = (uint32_t)(binding >> 32);
+		return (int)(uint32_t)binding;
+	}
+	uint32_t GetLastUsed() const {
+		return m_lastUsed.load(std::memory_order_relaxed);
+	}
+	void Touch(uint32_t frame) {
+		m_lastUsed.store(frame, std::memory_order_relaxed);
+	}
+	bool IsEvicted() const {
+		return m_evicted.load(std::memory_order_acquire);
+	}
+	void Evict() {
+		m_binding.store(Binding(-1, 0), std::memory_order_release);
+		m_evicted.store(true, std::memory_order_release);
+	}
+	void Reload(int id, uint32_t generation) {
+		m_binding.store(Binding(id, generation), std::memory_order_release);
+		m_evicted.store(false, std::memory_order_release);
 	}
 	int RemoveId() {
-		int ret = m_id;
-		m_id = -1;
-		return ret;
+		return (int)(uint32_t)m_binding.exchange(Binding(-1, 0), std::memory_order_acq_rel);
 	}
 	bgfx_texture_handle_t GetInterface() const {
 		return m_handle;
@@ -108,46 +243,47 @@ public:
 	}
 };
 
+#define STATE_BLEND_COUNT 5	// Effekseer::AlphaBlendType
+#define STATE_CULLING_COUNT 3	// Effekseer::CullingType
+
 class RenderState : public EffekseerRenderer::RenderStateBase {
 private:
 	RendererImplemented* m_renderer;
 	bool m_invz;
+	// bgfx state of [DepthTest][DepthWrite][CullingType][AlphaBlend]
+	uint64_t m_table[2][2][STATE_CULLING_COUNT][STATE_BLEND_COUNT];
+	static uint64_t MakeState(bool depthTest, bool depthWrite, int culling, int blend, bool invz);
 public:
-	RenderState(RendererImplemented* renderer, bool invz) : m_renderer(renderer), m_invz(invz) {}
+	RenderState(RendererImplemented* renderer, bool invz) : m_renderer(renderer), m_invz(invz) {
+		int t, w, c, b;
+		for (t=0;t<2;t++)
+			for (w=0;w<2;w++)
+				for (c=0;c<STATE_CULLING_COUNT;c++)
+					for (b=0;b<STATE_BLEND_COUNT;b++)
+						m_table[t][w][c][b] = MakeState(t, w, c, b, invz);
+	}
 	virtual ~RenderState() override = default;
 	void Update(bool forced);
 };
 
 class TextureLoader : public Effekseer::TextureLoader {
 private:
-	const RendererImplemented *m_render;
+	RendererImplemented *m_render;
 	void *m_ud;
 	int (*m_loader)(const char *name, int srgb, void *ud);
 	void (*m_unloader)(int id, void *ud);
 public:
-	TextureLoader(const RendererImplemented *render, InitArgs *init) : m_render(render) {
+	TextureLoader(RendererImplemented *render, InitArgs *init) : m_render(render) {
 		m_ud = init->ud;
 		m_loader = init->texture_load;
 		m_unloader = init->texture_unload;
 	}
 	virtual ~TextureLoader() = default;
-	Effekseer::TextureRef Load(const char16_t* path, Effekseer::TextureType textureType) override {
-		char buffer[MAX_PATH];
-		Effekseer::ConvertUtf16ToUtf8(buffer, MAX_PATH, path);
-		// always create gamma space texture, Effekseer will convert color in shader with MiscFlag set to convert
-		const int srgb = 0; //textureType == Effekseer::TextureType::Color;
-		int id = m_loader(buffer, srgb, m_ud);
-		if (id < 0)
-			return nullptr;
-
-		auto texture = Effekseer::MakeRefPtr<Effekseer::Texture>();
-		texture->SetBackend(Effekseer::MakeRefPtr<Texture>(m_render, id));
-		return texture;
-	}
-	void Unload(Effekseer::TextureRef texture) override {
-		int id = texture->GetBackend().DownCast<Texture>()->RemoveId();
-		m_unloader(id, m_ud);
-	}
+	// The textures are cached by the renderer, so a file is loaded and unloaded only once (See AcquireTexture)
+	Effekseer::TextureRef Load(const char16_t* path, Effekseer::TextureType textureType) override;
+	void Unload(Effekseer::TextureRef texture) override;
+private:
+	void UnloadId(const Effekseer::TextureRef& texture);
 };
 
 class Renderer : public EffekseerRenderer::Renderer {
@@ -187,7 +323,7 @@ private:
 		friend class RendererImplemented;
 	private:
 		static const int maxUniform = 64;
-		static const int maxSamplers = 8;
+		static const int maxSamplers = MATERIAL_META_MAX_SAMPLERS;
 		int m_vcbSize = 0;
 		int m_pcbSize = 0;
 		int m_vsSize = 0;
@@ -197,11 +333,38 @@ private:
 		struct {
 			bgfx_uniform_handle_t handle;
 			int count;
+			int size;	// bytes of ptr
 			void * ptr;
 		} m_uniform[maxUniform];
 		bgfx_uniform_handle_t m_samplers[maxSamplers];
+		// name -> index of m_uniform, built by InitShader
+		struct UniformSlot {
+			int vs = -1;
+			int fs = -1;
+			int num = 0;
+			bgfx_uniform_type_t type;
+		};
+		std::unordered_map<std::string, UniformSlot> m_uniformIndex;
 		bgfx_program_handle_t m_program;
 		const RendererImplemented *m_render;
+		// A shared shader borrows the program and uniforms of another shader (see CloneShader)
+		bool m_shared = false;
+		uint32_t m_serial;
+		uint32_t m_sourceSerial = 0;
+		// Material shaders are shared by the materials with the same GUID (See AcquireMaterialShader)
+		uint64_t m_guid = 0;
+		int m_kind = -1;
+		int m_ref = 0;
+		// The variant of model shader which reads instance data instead of uniform arrays (modelinst_*)
+		Shader *m_instanced = nullptr;
+		// Byte offsets of the per model arrays in the vertex constant buffer of model shaders, See AppendInstances
+		int m_modelMatrixOffset = 0;
+		int m_modelUVOffset = 0;
+		int m_modelColorOffset = 0;
+		static uint32_t NewSerial() {
+			static std::atomic<uint32_t> serial(0);
+			return ++serial;
+		}
 	public:
 		enum UniformType {
 			Vertex,
@@ -209,8 +372,10 @@ private:
 			Texture,
 		};
 		Shader(const RendererImplemented * render)
-			: m_render(render) {}
+			: m_render(render)
+			, m_serial(NewSerial()) {}
 		~Shader() override {
+			delete m_instanced;
 			delete[] m_vcbBuffer;
 			delete[] m_pcbBuffer;
 			if (m_render)
@@ -237,7 +402,8 @@ private:
 			return m_pcbBuffer;
 		}
 		virtual void SetConstantBuffer() override {
-			m_render->SumbitUniforms(this);
+			// Uniforms are submitted by the renderer which draws (DrawSprites/DrawPolygonInstanced),
+			// because the shader may be shared by renderers on different threads.
 		}
 		bool isValid() const {
 			return m_render != nullptr;
@@ -246,144 +412,157 @@ private:
 	class MaterialLoader : public Effekseer::MaterialLoader {
 	private:
 		RendererImplemented *m_render;
-		Effekseer::FileInterfaceRef m_file;
+		FileReader m_reader;
 		
-		void SetUniforms(Shader *shader, Effekseer::MaterialFile &materialFile, bool isModel, int st, int instancing) {
-			auto generator = EffekseerRenderer::MaterialShaderParameterGenerator(materialFile, isModel, st, instancing);
-			shader->SetVertexConstantBufferSize(generator.VertexShaderUniformBufferSize);
-			shader->SetPixelConstantBufferSize(generator.PixelShaderUniformBufferSize);
-#define UNIFORM(uname, offset) m_render->AddUniform(shader, uname, Shader::UniformType::Vertex, offset);
-				UNIFORM("uMatCamera", generator.VertexCameraMatrixOffset)
-				UNIFORM("uMatProjection", generator.VertexProjectionMatrixOffset)
-				UNIFORM("mUVInversed", generator.VertexInversedFlagOffset)
-				UNIFORM("predefined_uniform", generator.VertexPredefinedOffset)
-				UNIFORM("cameraPosition", generator.VertexCameraPositionOffset)
-				UNIFORM("customData1", generator.VertexModelCustomData1Offset)
-				UNIFORM("customData2", generator.VertexModelCustomData2Offset)
+		void SetUniforms(Shader *shader, const MaterialDesc &desc, int kind) {
+			const MaterialMetaShader &offsets = desc.meta.shader[kind];
+			const int st = kind & 1;
+			shader->SetVertexConstantBufferSize(offsets.vsSize);
+			shader->SetPixelConstantBufferSize(offsets.psSize);
+#define UNIFORM(uname, offset) m_render->AddUniform(shader, uname, Shader::UniformType::Vertex, offsets.vs[offset]);
+				UNIFORM("uMatCamera", MATERIAL_META_VS_CAMERA)
+				UNIFORM("uMatProjection", MATERIAL_META_VS_PROJECTION)
+				UNIFORM("mUVInversed", MATERIAL_META_VS_UVINVERSED)
+				UNIFORM("predefined_uniform", MATERIAL_META_VS_PREDEFINED)
+				UNIFORM("cameraPosition", MATERIAL_META_VS_CAMERAPOSITION)
+				UNIFORM("customData1", MATERIAL_META_VS_CUSTOMDATA1)
+				UNIFORM("customData2", MATERIAL_META_VS_CUSTOMDATA2)
 #undef UNIFORM
-			for (int32_t ui = 0; ui < materialFile.GetUniformCount(); ui++)	{
-				m_render->AddUniform(shader, materialFile.GetUniformName(ui), Shader::UniformType::Vertex, generator.VertexUserUniformOffset + sizeof(float) * 4 * ui);
+			for (int32_t ui = 0; ui < desc.meta.uniformCount; ui++)	{
+				m_render->AddUniform(shader, desc.uniformNames[ui], Shader::UniformType::Vertex, offsets.vsUser + sizeof(float) * 4 * ui);
 			}
-#define UNIFORM(uname, offset) m_render->AddUniform(shader, uname, Shader::UniformType::Pixel, offset);
-				UNIFORM("mUVInversedBack", generator.PixelInversedFlagOffset)
-				UNIFORM("predefined_uniform", generator.PixelPredefinedOffset)
-				UNIFORM("cameraPosition", generator.PixelCameraPositionOffset)
-				UNIFORM("reconstructionParam1", generator.PixelReconstructionParam1Offset)
-				UNIFORM("reconstructionParam2", generator.PixelReconstructionParam2Offset)
+#define UNIFORM(uname, offset) m_render->AddUniform(shader, uname, Shader::UniformType::Pixel, offsets.ps[offset]);
+				UNIFORM("mUVInversedBack", MATERIAL_META_PS_UVINVERSEDBACK)
+				UNIFORM("predefined_uniform", MATERIAL_META_PS_PREDEFINED)
+				UNIFORM("cameraPosition", MATERIAL_META_PS_CAMERAPOSITION)
+				UNIFORM("reconstructionParam1", MATERIAL_META_PS_RECONSTRUCTION1)
+				UNIFORM("reconstructionParam2", MATERIAL_META_PS_RECONSTRUCTION2)
 				// shiding model
-				if (materialFile.GetShadingModel() == Effekseer::ShadingModelType::Lit) {
-					UNIFORM("lightDirection", generator.PixelLightDirectionOffset)
-					UNIFORM("lightColor", generator.PixelLightColorOffset)
-					UNIFORM("lightAmbientColor", generator.PixelLightAmbientColorOffset)
+				if (desc.meta.shadingModel == (uint8_t)Effekseer::ShadingModelType::Lit) {
+					UNIFORM("lightDirection", MATERIAL_META_PS_LIGHTDIRECTION)
+					UNIFORM("lightColor", MATERIAL_META_PS_LIGHTCOLOR)
+					UNIFORM("lightAmbientColor", MATERIAL_META_PS_LIGHTAMBIENT)
 				}
-				if (materialFile.GetHasRefraction() && st == 1)
-					UNIFORM("cameraMat", generator.PixelCameraMatrixOffset)
+				if (desc.meta.refraction && st == 1)
+					UNIFORM("cameraMat", MATERIAL_META_PS_CAMERAMATRIX)
 #undef UNIFORM
-			for (int32_t ui = 0; ui < materialFile.GetUniformCount(); ui++)	{
-				m_render->AddUniform(shader, materialFile.GetUniformName(ui), Shader::UniformType::Vertex, generator.PixelUserUniformOffset + sizeof(float) * 4 * ui);
+			for (int32_t ui = 0; ui < desc.meta.uniformCount; ui++)	{
+				m_render->AddUniform(shader, desc.uniformNames[ui], Shader::UniformType::Pixel, offsets.psUser + sizeof(float) * 4 * ui);
 			}
 
 			int maxid = 0;
-			for (int32_t ti = 0; ti < materialFile.GetTextureCount(); ti++)	{
-				int id = materialFile.GetTextureIndex(ti);
-				m_render->AddUniform(shader, materialFile.GetTextureName(ti), Shader::UniformType::Texture, id);
+			for (int32_t ti = 0; ti < desc.meta.textureCount; ti++)	{
+				int id = desc.textures[ti].index;
+				m_render->AddUniform(shader, desc.textureNames[ti], Shader::UniformType::Texture, id);
 				if (id > maxid)
 					maxid = id;
 			}
 			m_render->AddUniform(shader, "efk_background", Shader::UniformType::Texture, maxid+1);
 			m_render->AddUniform(shader, "efk_depth", Shader::UniformType::Texture, maxid+2);
 		}
-	public:
-		MaterialLoader(RendererImplemented *render, Effekseer::FileInterfaceRef f)
-			: m_render(render)
-			, m_file(f) {
-			if (f == nullptr) {
-				m_file = Effekseer::MakeRefPtr<Effekseer::DefaultFileInterface>();
+		Shader * LoadMaterialShader(const MaterialDesc &desc, const char *matpath, int st, bool isModel) {
+			static const char *shadername[MATERIAL_SHADER_KIND] = {
+				"sprite",
+				"sprite_refraction",
+				"model",
+				"model_refraction",
+			};
+			const int kind = (isModel ? 2 : 0) + st;
+			RendererImplemented *root = m_render->Root();
+			Shader *shader = root->AcquireMaterialShader(desc.meta.guid, kind);
+			if (shader)
+				return shader;
+
+			if (isModel) {
+				m_render->GetModelLayoutHandle();
+			} else {
+				m_render->GetLayoutHandle(MaterialLayout(desc.meta.simpleVertex,
+					desc.meta.customData1, desc.meta.customData2));
+			}
+
+			shader = new Shader(root);
+			root->InitShader(shader,
+				m_render->LoadShader(matpath, shadername[kind], "vs"),
+				m_render->LoadShader(matpath, shadername[kind], "fs"));
+			if (!shader->isValid()) {
+				delete shader;
+				return nullptr;
 			}
+			SetUniforms(shader, desc, kind);
+			if (isModel) {
+				shader->m_modelMatrixOffset = desc.meta.shader[kind].vs[MATERIAL_META_VS_MODELMATRIX];
+				shader->m_modelUVOffset = desc.meta.shader[kind].vs[MATERIAL_META_VS_MODELUV];
+				shader->m_modelColorOffset = desc.meta.shader[kind].vs[MATERIAL_META_VS_MODELCOLOR];
+				// The instance data has no custom data, the materials with it always use uniform arrays
+				if (desc.meta.customData1 == 0 && desc.meta.customData2 == 0)
+					root->CreateInstancedMaterialShader(shader, matpath, st);
+			}
+			return root->AddMaterialShader(desc.meta.guid, kind, shader);
 		}
+	public:
+		MaterialLoader(RendererImplemented *render, InitArgs *init, Effekseer::FileInterfaceRef f)
+			: m_render(render)
+			, m_reader(f, init->ud, init->material_load, init->material_unload) {}
 		virtual ~MaterialLoader() override = default;
 		
 		Effekseer::MaterialRef Load(const char16_t* path) override {
-			// todo: load mat callback
-			auto reader = m_file->OpenRead(path);
-			if (reader == nullptr)
-				return nullptr;
-
-			size_t size = reader->GetLength();
-			std::vector<char> data;
-			data.resize(size);
-			reader->Read(data.data(), size);
-
 			char matpath[MAX_PATH];
 			Effekseer::ConvertUtf16ToUtf8(matpath, MAX_PATH, path);
 
-			Effekseer::MaterialFile materialFile;
-			if (!materialFile.Load((const uint8_t*)data.data(), (uint32_t)size))	{
-				// Invalid material
-				return nullptr;
-			}
+			Effekseer::MaterialRef material;
+			const std::u16string metapath = std::u16string(path) + u".meta";
+			m_reader.Read(path, [&](const void *data, size_t size) {
+				// The sidecar generated by efkmatc (See bgfxmaterialmeta.h) doesn't need parsing, if it's generated from this .efkmat
+				m_reader.Read(metapath.c_str(), [&](const void *meta, size_t metaSize) {
+					MaterialDesc desc;
+					if (desc.Load(meta, metaSize) && desc.Match(data, size))
+						material = LoadMaterial(matpath, desc);
+				});
+				if (material != nullptr)
+					return;
+				Effekseer::MaterialFile materialFile;
+				if (!materialFile.Load((const uint8_t*)data, (int32_t)size))	{
+					// Invalid material
+					return;
+				}
+				MaterialDesc desc;
+				desc.Load(materialFile, data, size);
+				material = LoadMaterial(matpath, desc);
+			});
+			return material;
+		}
+		Effekseer::MaterialRef LoadMaterial(const char *matpath, const MaterialDesc &desc) {
+			const MaterialMeta &meta = desc.meta;
 			auto material = Effekseer::MakeRefPtr<::Effekseer::Material>();
-			material->IsSimpleVertex = materialFile.GetIsSimpleVertex();
-			material->IsRefractionRequired = materialFile.GetHasRefraction();
-
-			std::array<Effekseer::MaterialShaderType, 2> shaderTypes;
-			std::array<Effekseer::MaterialShaderType, 2> shaderTypesModel;
-
-			shaderTypes[0] = Effekseer::MaterialShaderType::Standard;
-			shaderTypes[1] = Effekseer::MaterialShaderType::Refraction;
-			shaderTypesModel[0] = Effekseer::MaterialShaderType::Model;
-			shaderTypesModel[1] = Effekseer::MaterialShaderType::RefractionModel;
-			int32_t shaderTypeCount = 1;
-
-			if (materialFile.GetHasRefraction())
-				shaderTypeCount = 2;
-
-			const char *shadername[2] = {
-				"sprite",
-				"sprite_refraction",
-			};
-
+			material->IsSimpleVertex = meta.simpleVertex;
+			material->IsRefractionRequired = meta.refraction;
+			material->CustomData1 = meta.customData1;
+			material->CustomData2 = meta.customData2;
+			material->TextureCount = std::min((int)meta.textureCount, Effekseer::UserTextureSlotMax);
+			material->UniformCount = meta.uniformCount;
+			material->ShadingModel = (Effekseer::ShadingModelType)meta.shadingModel;
+
+			const int32_t shaderTypeCount = meta.refraction ? 2 : 1;
 			// Create sprite shader
 			for (int32_t st = 0; st < shaderTypeCount; st++) {
-				bgfx_vertex_layout_handle_t layout;
-				if (material->IsSimpleVertex) {
-					layout = m_render->CreateMaterialSimple();
-				} else {
-					layout = m_render->CreateMaterialComplex(materialFile.GetCustomData1Count(), materialFile.GetCustomData2Count());
-				}
-
-				Shader *shader = new Shader(m_render);
-				m_render->InitShader(shader,
-					m_render->LoadShader(matpath, shadername[st], "vs"),
-					m_render->LoadShader(matpath, shadername[st], "fs"));
-				if (!shader->isValid())
+				Shader *shader = LoadMaterialShader(desc, matpath, st, false);
+				if (shader == nullptr) {
+					Unload(material);
 					return nullptr;
-				SetUniforms(shader, materialFile, false, st, 1);
-
-				material->TextureCount = std::min(materialFile.GetTextureCount(), Effekseer::UserTextureSlotMax);
-				material->UniformCount = materialFile.GetUniformCount();
-
+				}
 				if (st == 0) {
 					material->UserPtr = shader;
 				} else {
 					material->RefractionUserPtr = shader;
 				}
 			}
-			const char *shadername_model[2] = {
-				"model",
-				"model_refraction",
-			};
-
 			// Create model shader
 			for (int32_t st = 0; st < shaderTypeCount; st++) {
-				bgfx_vertex_layout_handle_t layout = m_render->CreateMaterialModel();
-				Shader *shader =  new Shader(m_render);
-				m_render->InitShader(shader,
-					m_render->LoadShader(matpath, shadername_model[st], "vs"),
-					m_render->LoadShader(matpath, shadername_model[st], "fs"));
-				if (!shader->isValid())
+				Shader *shader = LoadMaterialShader(desc, matpath, st, true);
+				if (shader == nullptr) {
+					Unload(material);
 					return nullptr;
-				SetUniforms(shader, materialFile, true, st, MaxInstanced);
+				}
 				if (st == 0) {
 					material->ModelUserPtr = shader;
 				} else {
@@ -391,29 +570,19 @@ private:
 				}
 			}
 
-			material->CustomData1 = materialFile.GetCustomData1Count();
-			material->CustomData2 = materialFile.GetCustomData2Count();
-			material->TextureCount = std::min(materialFile.GetTextureCount(), Effekseer::UserTextureSlotMax);
-			material->UniformCount = materialFile.GetUniformCount();
-			material->ShadingModel = materialFile.GetShadingModel();
-
 			for (int32_t i = 0; i < material->TextureCount; i++) {
-				material->TextureWrapTypes.at(i) = materialFile.GetTextureWrap(i);
+				material->TextureWrapTypes.at(i) = (Effekseer::TextureWrapType)desc.textures[i].wrap;
 			}
 			return material;
 		}
 		void Unload(Effekseer::MaterialRef data) override {
 			if (data == nullptr)
 				return;
-			auto shader = reinterpret_cast<Shader*>(data->UserPtr);
-			auto modelShader = reinterpret_cast<Shader*>(data->ModelUserPtr);
-			auto refractionShader = reinterpret_cast<Shader*>(data->RefractionUserPtr);
-			auto refractionModelShader = reinterpret_cast<Shader*>(data->RefractionModelUserPtr);
-
-			ES_SAFE_DELETE(shader);
-			ES_SAFE_DELETE(modelShader);
-			ES_SAFE_DELETE(refractionShader);
-			ES_SAFE_DELETE(refractionModelShader);
+			RendererImplemented *root = m_render->Root();
+			root->ReleaseMaterialShader(reinterpret_cast<Shader*>(data->UserPtr));
+			root->ReleaseMaterialShader(reinterpret_cast<Shader*>(data->ModelUserPtr));
+			root->ReleaseMaterialShader(reinterpret_cast<Shader*>(data->RefractionUserPtr));
+			root->ReleaseMaterialShader(reinterpret_cast<Shader*>(data->RefractionModelUserPtr));
 
 			data->UserPtr = nullptr;
 			data->ModelUserPtr = nullptr;
@@ -421,6 +590,43 @@ private:
 			data->RefractionModelUserPtr = nullptr;
 		}
 	};
+	class ModelLoader : public Effekseer::ModelLoader {
+	private:
+		FileReader m_reader;
+	public:
+		ModelLoader(RendererImplemented *render, InitArgs *init, Effekseer::FileInterfaceRef f)
+			: m_reader(f, init->ud, init->model_load, init->model_unload) {}
+		virtual ~ModelLoader() override = default;
+
+		Effekseer::ModelRef Load(const char16_t* path) override {
+			// The model copies what it needs, so the file can be mapped instead of read
+			Effekseer::ModelRef model;
+			m_reader.Read(path, [&](const void *data, size_t size) {
+				model = Load(data, (int32_t)size);
+			});
+			return model;
+		}
+		Effekseer::ModelRef Load(const void* data, int32_t size) override {
+			if (data == nullptr || size <= 0)
+				return nullptr;
+			// The buffers are created by StoreModelToGPU on first draw (or Prewarm)
+			return Effekseer::MakeRefPtr<Effekseer::Model>(data, size);
+		}
+		void Unload(Effekseer::ModelRef data) override {}
+	};
+	// A model whose buffers are referenced by bgfx (make_ref_release), it's kept alive until bgfx has copied them.
+	// pending counts the references of bgfx, and one of the renderer (m_uploads) which collects it on the API thread.
+	// If the renderer is released first, the last release of bgfx deletes it. See ~RendererImplemented
+	struct ModelUpload {
+		Effekseer::ModelRef model;
+		std::atomic<int> pending;
+		static void Release(void *ptr, void *ud) {
+			// Called by bgfx, maybe in the render thread
+			ModelUpload *upload = (ModelUpload *)ud;
+			if (upload->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete upload;
+		}
+	};
 	class StaticIndexBuffer : public Effekseer::Backend::IndexBuffer {
 	private:
 		const RendererImplemented * m_render;
@@ -435,7 +641,13 @@ private:
 			elementCount_ = count;
 		}
 		virtual ~StaticIndexBuffer() override {
-			m_render->ReleaseIndexBuffer(this);
+			Detach();
+		}
+		// Destroy the handle now, the object can be deleted after the renderer.
+		void Detach() {
+			if (m_render)
+				m_render->ReleaseIndexBuffer(this);
+			m_render = nullptr;
 		}
 		void UpdateData(const void* src, int32_t size, int32_t offset) override { assert(false); }	// Can't Update
 		bgfx_index_buffer_handle_t GetInterface() const { return m_buffer; }
@@ -450,37 +662,80 @@ private:
 			const RendererImplemented *render,
 			bgfx_vertex_buffer_handle_t buffer ) : m_render(render) , m_buffer(buffer) {}
 		virtual ~StaticVertexBuffer() override {
-			m_render->ReleaseVertexBuffer(this);
+			Detach();
+		}
+		void Detach() {
+			if (m_render)
+				m_render->ReleaseVertexBuffer(this);
+			m_render = nullptr;
 		}
 		void UpdateData(const void* src, int32_t size, int32_t offset) override { assert(false); }	// Can't Update
 		bgfx_vertex_buffer_handle_t GetInterface() const { return m_buffer; }
 	};
 	class BGFXStandardRenderer : public EffekseerRenderer::StandardRenderer<RendererImplemented, Shader> {
+		// A few fields compared by StandardRendererState::operator!=, packed without any loop.
+		// Different keys mean different states, so the full comparison is only needed when the keys are equal.
+		struct BatchKey {
+			uint64_t bits;	// render states, shader type and texture count
+			const void *material;
+			const void *texture;	// the first one
+			bool operator!=(const BatchKey &k) const {
+				return bits != k.bits || material != k.material || texture != k.texture;
+			}
+		};
+		static BatchKey MakeKey(const EffekseerRenderer::StandardRendererState& state) {
+			const auto &c = state.Collector;
+			const uint64_t bits = (uint64_t)state.DepthTest
+				| (uint64_t)state.DepthWrite << 1
+				| ((uint64_t)state.AlphaBlend & 0xff) << 8
+				| ((uint64_t)state.CullingType & 0xff) << 16
+				| ((uint64_t)c.ShaderType & 0xff) << 24
+				| ((uint64_t)c.TextureCount & 0xffffffff) << 32;
+			const void *texture = c.TextureCount > 0 ? c.Textures[0].Get() : nullptr;
+			return BatchKey { bits, c.MaterialDataPtr, texture };
+		}
+
 		RendererImplemented *m_renderer;
 		EffekseerRenderer::StandardRendererState m_state;
+		BatchKey m_key;	// MakeKey(m_state), updated only when m_state changes
 	public:
-		BGFXStandardRenderer(RendererImplemented* renderer) : StandardRenderer(renderer) , m_renderer(renderer) {}
+		BGFXStandardRenderer(RendererImplemented* renderer) : StandardRenderer(renderer) , m_renderer(renderer) {
+			m_key = MakeKey(m_state);
+		}
 		void BeginRenderingAndRenderingIfRequired(const EffekseerRenderer::StandardRendererState& state, int32_t count, int& stride, void*& data) {
-			if (state != m_state) {
-				DoRendering();
+			const BatchKey key = MakeKey(state);
+			if (key != m_key || state != m_state) {
+				ForcedRendering();
 				m_state = state;
-				m_renderer->SwitchLayout(state.Collector.ShaderType);
+				m_key = key;
+				m_renderer->SwitchLayout(state);
 			}
 			if (!m_renderer->AppendSprites(count, stride, data)) {
-				DoRendering();
+				ForcedRendering();
 				m_renderer->AppendSprites(count, stride, data);
 			}
-			if (state.Collector.IsBackgroundRequiredOnFirstPass && m_renderer->GetDistortingCallback() != nullptr) {
-				DoRendering();
+			if (state.Collector.IsBackgroundRequiredOnFirstPass && m_renderer->NeedGrabPerBatch()) {
+				// The next batch should see this one in the background
+				ForcedRendering();
 			}
 		}
 		void ResetAndRenderingIfRequired() {
 			DoRendering();
 		}
-		void DoRendering() {
+		void ForcedRendering() {
+			if (DoRendering())
+				++m_renderer->m_stats.forcedFlushes;
+		}
+		bool DoRendering() {
 			if (!m_renderer->NeedDraw())
-				return;
+				return false;
 
+			if (m_state.Collector.ShaderType != EffekseerRenderer::RendererShaderType::Material
+				&& m_renderer->GetShader(m_state.Collector.ShaderType) == nullptr) {
+				// The built-in program can't be loaded, drop the batch
+				m_renderer->ResetDraw();
+				return false;
+			}
 			const auto& mProj = m_renderer->GetProjectionMatrix();
 			const auto& mCamera = m_renderer->GetCameraMatrix();
 			int32_t passNum = 1;
@@ -494,6 +749,7 @@ private:
 				Rendering_(mCamera, mProj, 0, 0, 1, passInd, m_state);
 			}
 			m_renderer->ResetDraw();
+			return true;
 		}
 
 		EffekseerRenderer::StandardRendererState& GetState(){
@@ -502,118 +758,20 @@ private:
 
 		void Reset() {
 			m_state = EffekseerRenderer::StandardRendererState();
+			m_key = MakeKey(m_state);
 		} 
 	};
 public:
 	class ModelRenderer : public EffekseerRenderer::ModelRendererBase {
 	private:
 		RendererImplemented* m_render;
-		Shader * m_shaders[SHADERCOUNT];
 	public:
 		ModelRenderer(RendererImplemented* renderer) : m_render(renderer) {
-			int i;
-			for (i=0;i<SHADERCOUNT;i++) {
-				m_shaders[i] = nullptr;
-			}
-
 			VertexType = EffekseerRenderer::ModelRendererVertexType::Instancing;
 		}
-		virtual ~ModelRenderer() override {
-			for (auto shader : m_shaders) {
-				ES_SAFE_DELETE(shader);
-			}
-		}
+		virtual ~ModelRenderer() override = default;
 		bool Initialize(struct InitArgs *init) {
-//			const uint32_t depthSlot[(int)EffekseerRenderer::RendererShaderType::Material] = {1, 2, 2, 6, 7, 7,};
-			for (auto t : {
-				EffekseerRenderer::RendererShaderType::Unlit,
-				EffekseerRenderer::RendererShaderType::Lit,
-				EffekseerRenderer::RendererShaderType::BackDistortion,
-				EffekseerRenderer::RendererShaderType::AdvancedUnlit,
-				EffekseerRenderer::RendererShaderType::AdvancedLit,
-				EffekseerRenderer::RendererShaderType::AdvancedBackDistortion,
-			}) {
-				Shader * s = m_render->CreateShader();
-				int id = (int)t;
-				m_shaders[id] = s;
-				const char *shadername = NULL;
-				switch (t) {
-				case EffekseerRenderer::RendererShaderType::Unlit :
-					shadername = "model_unlit";
-					break;
-				case EffekseerRenderer::RendererShaderType::Lit :
-					shadername = "model_lit";
-					break;
-				case EffekseerRenderer::RendererShaderType::BackDistortion :
-					shadername = "model_distortion";
-					break;
-				case EffekseerRenderer::RendererShaderType::AdvancedUnlit :
-					shadername = "model_adv_unlit";
-					break;
-				case EffekseerRenderer::RendererShaderType::AdvancedLit :
-					shadername = "model_adv_lit";
-					break;
-				case EffekseerRenderer::RendererShaderType::AdvancedBackDistortion :
-					shadername = "model_adv_distortion";
-					break;
-				default:
-					assert(false);
-					break;
-				}
-				if (!m_render->InitShader(s,
-					m_render->LoadShader(NULL, shadername, "vs"),
-					m_render->LoadShader(NULL, shadername, "fs"))){
-					return false;
-				}
-			}
-			for (auto t : {
-				EffekseerRenderer::RendererShaderType::Unlit,
-				EffekseerRenderer::RendererShaderType::Lit,
-				EffekseerRenderer::RendererShaderType::BackDistortion,
-			}) {
-				Shader * s = m_shaders[(int)t];
-				typedef EffekseerRenderer::ModelRendererVertexConstantBuffer<MaxInstanced> VCB;
-				s->SetVertexConstantBufferSize(sizeof(VCB));
-#define VUNIFORM(uname, fname) m_render->AddUniform(s, #uname, Shader::UniformType::Vertex, offsetof(VCB, fname));
-					VUNIFORM(u_mCameraProj, 	CameraMatrix)
-					VUNIFORM(u_mModel_Inst, 	ModelMatrix)
-					VUNIFORM(u_fUV, 			ModelUV)
-					VUNIFORM(u_fModelColor, 	ModelColor)
-					VUNIFORM(u_fLightDirection,	LightDirection)
-					VUNIFORM(u_fLightColor, 	LightColor)
-					VUNIFORM(u_fLightAmbient, 	LightAmbientColor)
-					VUNIFORM(u_mUVInversed, 	UVInversed)
-#undef VUNIFORM
-			}
-			for (auto t : {
-				EffekseerRenderer::RendererShaderType::AdvancedUnlit,
-				EffekseerRenderer::RendererShaderType::AdvancedLit,
-				EffekseerRenderer::RendererShaderType::AdvancedBackDistortion,
-			}) {
-				Shader * s = m_shaders[(int)t];
-				typedef EffekseerRenderer::ModelRendererAdvancedVertexConstantBuffer<MaxInstanced> VCB;
-				s->SetVertexConstantBufferSize(sizeof(VCB));
-#define VUNIFORM(uname, fname) m_render->AddUniform(s, #uname, Shader::UniformType::Vertex, offsetof(VCB, fname));
-					VUNIFORM(u_mCameraProj, 		CameraMatrix)
-					VUNIFORM(u_mModel_Inst, 		ModelMatrix)
-					VUNIFORM(u_fUV, 				ModelUV)
-					VUNIFORM(u_fAlphaUV, 			ModelAlphaUV)
-					VUNIFORM(u_fUVDistortionUV, 	ModelUVDistortionUV)
-					VUNIFORM(u_fBlendUV, 			ModelBlendUV)
-					VUNIFORM(u_fBlendAlphaUV, 		ModelBlendAlphaUV)
-					VUNIFORM(u_fBlendUVDistortionUV,ModelBlendUVDistortionUV)
-					VUNIFORM(u_fFlipbookParameter, 	ModelFlipbookParameter)
-					VUNIFORM(u_fFlipbookIndexAndNextRate, ModelFlipbookIndexAndNextRate)
-					VUNIFORM(u_fModelAlphaThreshold,ModelAlphaThreshold)
-					VUNIFORM(u_fModelColor, 		ModelColor)
-					VUNIFORM(u_fLightDirection, 	LightDirection)
-					VUNIFORM(u_fLightColor, 		LightColor)
-					VUNIFORM(u_fLightAmbient, 	LightAmbientColor)
-					VUNIFORM(u_mUVInversed, 		UVInversed)
-#undef VUNIFORM
-			}
-			m_render->SetPixelConstantBuffer(m_shaders);
-			m_render->SetSamplers(m_shaders);
+			(void)init;
 			return true;
 		}
 		void BeginRendering(const Effekseer::ModelRenderer::NodeParameter& parameter, int32_t count, void* userData) override {
@@ -632,12 +790,27 @@ public:
 			if (!m_render->StoreModelToGPU(model)) {
 				return;
 			}
-			Shader * shader_ad_lit_ = m_shaders[(int)EffekseerRenderer::RendererShaderType::AdvancedLit];
-			Shader * shader_ad_unlit_ = m_shaders[(int)EffekseerRenderer::RendererShaderType::AdvancedUnlit];
-			Shader * shader_ad_distortion_ = m_shaders[(int)EffekseerRenderer::RendererShaderType::AdvancedBackDistortion];
-			Shader * shader_lit_ = m_shaders[(int)EffekseerRenderer::RendererShaderType::Lit];
-			Shader * shader_unlit_ = m_shaders[(int)EffekseerRenderer::RendererShaderType::Unlit];
-			Shader * shader_distortion_ = m_shaders[(int)EffekseerRenderer::RendererShaderType::BackDistortion];
+			Shader * shaders[SHADERCOUNT] = { nullptr };
+			if (m_render->IsModelShadersReady()) {
+				for (int i=0;i<SHADERCOUNT;i++)
+					shaders[i] = m_render->GetModelShader((EffekseerRenderer::RendererShaderType)i);
+			} else {
+				// Only the shader selected by EndRendering_ is needed, so create (See GetModelShader) just that one.
+				EffekseerRenderer::ShaderParameterCollector collector;
+				collector.Collect(m_render, parameter.EffectPointer, parameter.BasicParameterPtr, parameter.EnableFalloff, m_render->GetImpl()->isSoftParticleEnabled);
+				if (collector.ShaderType != EffekseerRenderer::RendererShaderType::Material) {
+					Shader * s = m_render->GetModelShader(collector.ShaderType);
+					if (s == nullptr)
+						return;
+					shaders[(int)collector.ShaderType] = s;
+				}
+			}
+			Shader * shader_ad_lit_ = shaders[(int)EffekseerRenderer::RendererShaderType::AdvancedLit];
+			Shader * shader_ad_unlit_ = shaders[(int)EffekseerRenderer::RendererShaderType::AdvancedUnlit];
+			Shader * shader_ad_distortion_ = shaders[(int)EffekseerRenderer::RendererShaderType::AdvancedBackDistortion];
+			Shader * shader_lit_ = shaders[(int)EffekseerRenderer::RendererShaderType::Lit];
+			Shader * shader_unlit_ = shaders[(int)EffekseerRenderer::RendererShaderType::Unlit];
+			Shader * shader_distortion_ = shaders[(int)EffekseerRenderer::RendererShaderType::BackDistortion];
 			EndRendering_<RendererImplemented, Shader, Effekseer::Model, true, MaxInstanced>(
 				m_render, shader_ad_lit_, shader_ad_unlit_, shader_ad_distortion_, shader_lit_, shader_unlit_, shader_distortion_, parameter, userData);
 		}
@@ -649,30 +822,136 @@ private:
 	bool m_restorationOfStates = true;
 	BGFXStandardRenderer * m_standardRenderer = nullptr;
 	EffekseerRenderer::DistortingCallback* m_distortingCallback = nullptr;
+	// Returned by GetDistortingCallback, it does the bookkeeping of a grab when it's called, then calls m_distortingCallback.
+	class DistortingProxy : public EffekseerRenderer::DistortingCallback {
+		RendererImplemented *m_render;
+	public:
+		explicit DistortingProxy(RendererImplemented *render) : m_render(render) {}
+		bool OnDistorting(EffekseerRenderer::Renderer* renderer) override {
+			return m_render->GrabBackground(renderer);
+		}
+	};
+	DistortingProxy m_distortingProxy { this };
+	int m_distortionMode = DISTORTION_EVERY_BATCH;
+	bool m_backgroundGrabbed = false;	// by the distorting callback in this frame (DISTORTION_ONCE_PER_FRAME)
+	bool m_backgroundValid = false;	// m_background is fetched by texture_get
 	StaticIndexBuffer* m_indexBuffer = nullptr;
-	bgfx_vertex_buffer_handle_t m_currentVertexBuffer;
+	// The buffers of the model set by SetVertexBuffer/SetIndexBuffer, invalid for sprites. See BindModelBuffers
+	bgfx_vertex_buffer_handle_t m_currentVertexBuffer = BGFX_INVALID_HANDLE;
+	bgfx_index_buffer_handle_t m_currentIndexBuffer = BGFX_INVALID_HANDLE;
+	// The textures set by SetTextures, the bindings are discarded after each submit too. See BindTextures
+	struct TextureBinding {
+		bgfx_uniform_handle_t sampler;
+		bgfx_texture_handle_t handle;
+		uint32_t flags;
+	};
+	TextureBinding m_textureBindings[Shader::maxSamplers];
+	int m_textureBindingCount = 0;
 	DummyVertexBuffer* m_vertexBuffer = nullptr;
-	const bgfx_memory_t *m_tvb_buffer = nullptr;
+	std::vector<uint8_t> m_scratch;	// for the vertices dropped when the transient buffer is exhausted
+	std::vector<float> m_instanceData;	// See AppendInstances
+	int m_instanceCount = 0;
+	uint32_t m_instanceVertices = 0;	// vertices and indices of the model drawn by the instances
+	uint32_t m_instanceIndices = 0;
 	Shader* m_currentShader = nullptr;
 	Effekseer::Backend::TextureRef m_background = nullptr;
 	Effekseer::Backend::TextureRef m_depth = nullptr;
+	// The copies of scene color and depth, indexed by TEXTURE_BACKGROUND/TEXTURE_DEPTH. Only in the root renderer, See Capture()
+	struct CaptureTarget {
+		bgfx_texture_handle_t src;
+		bgfx_texture_handle_t dst;
+		uint32_t frame;	// m_captureFrame when it's copied
+	};
+	struct {
+		bgfx_view_id_t viewid;
+		uint16_t width;
+		uint16_t height;
+		CaptureTarget target[2];
+	} m_capture;
+	CaptureStats m_captureStats = {};
+	uint32_t m_captureFrame = 0;	// increased by BeginRendering of the root renderer, See Capture()
+	bool m_homogeneousDepth = false;	// bgfx caps, NDC depth is [-1, 1]
 	int32_t m_squareMaxCount = 0;
 	int32_t m_indexBufferStride = 2;
 	bgfx_view_id_t m_viewid = 0;
 	bgfx_vertex_layout_t m_modellayout;
+	bgfx_vertex_layout_handle_t m_modellayoutHandle = BGFX_INVALID_HANDLE;
 
 	struct VertexLayoutInfo {
 		bgfx_vertex_layout_t			layout;
+		bgfx_vertex_layout_handle_t		handle;	// created by GetLayoutHandle()
 		bgfx_transient_vertex_buffer_t	tvb;
-		int offset;
-		int count;
-		int cap;
+		int offset;	// vertices already drawn
+		int count;	// vertices in tvb
+		int cap;	// size of tvb, 0 means no buffer
+		int total;	// vertices appended since BeginRendering
+		int hint;	// size of the first tvb, adapts to the demand of the previous passes
+		uint8_t *data;	// tvb.data, or the staging memory in m_rings
+		int ring;	// start vertex in m_rings, -1 means tvb
+	};
+	// Dynamic vertex buffer for VERTEX_BUFFER_DYNAMIC mode, it has RING_FRAMES segments.
+	// A segment is written only in one frame, and it's not reused until RING_FRAMES frames later,
+	// so the staging memory referenced by make_ref is always valid until bgfx uploads it.
+	// Only the root renderer uses them, because update_dynamic_vertex_buffer must be called in the API thread.
+	struct VertexRing {
+		bgfx_dynamic_vertex_buffer_handle_t handle;
+		uint8_t *data;
+		int segment;	// vertices per segment
+		int head;	// used vertices in current segment
+		uint32_t frame;
+		bool wanted;	// used before it's created, create it in NextFrame()
 	};
+	VertexRing m_rings[LAYOUT_COUNT] = {};
+	// id -> handle, filled by SetTextureHandle, and read by the workers without lock. See TextureHandle()
+	// The handle (low 16 bits) and the generation (high 16 bits) are in one atomic word, so a reader never sees half of an update.
+	struct TextureSlot {
+		std::atomic<uint32_t> binding { UINT16_MAX };	// the generation is increased when the id is unloaded
+		std::atomic<int> size { 0 };	// bytes, for the texture budget
+	};
+	std::vector<TextureSlot> m_textureSlots;	// MAX_TEXTURE_ID slots in root, never resized
+	int m_textureBudget = 0;	// bytes, 0 means no limit
+	std::atomic<bool> m_dynamic { false };	// Only in the root renderer, See IsDynamic()
+	std::atomic<uint32_t> m_frame;	// See NextFrame()
 	VertexLayoutInfo m_layouts[LAYOUT_COUNT] = {0};
 	int m_current_layout = 0;
 	Shader * m_shaders[SHADERCOUNT];
+	Shader * m_modelShaders[SHADERCOUNT];
+	// The built-in shaders created by the root, bit n for m_shaders[n] and SHADERCOUNT+n for m_modelShaders[n]
+	std::atomic<uint32_t> m_builtinReady { 0 };
+	uint32_t m_builtinFailed = 0;	// guarded by m_lock
 	InitArgs m_initArgs;
 	bgfx_encoder_t *m_encoder = nullptr;
+	// The worker renderer shares shaders, index buffer and textures with the root renderer (m_parent)
+	RendererImplemented *m_parent = nullptr;
+	std::unordered_map<const Shader *, Shader *> m_clones;
+	mutable std::mutex m_lock;
+	// GUID -> material shader, for each kind (sprite, sprite_refraction, model, model_refraction)
+	std::unordered_map<uint64_t, Shader *> m_materialShaders[MATERIAL_SHADER_KIND];
+	// Texture cache : "type:path" -> texture, See TextureLoader::Load
+	struct CachedTexture {
+		Effekseer::TextureRef texture;
+		int ref;
+		std::string path;	// for reloading the evicted texture
+		int srgb;
+	};
+	std::unordered_map<std::string, CachedTexture> m_textures;
+	std::unordered_map<Effekseer::Texture *, std::string> m_textureKeys;
+	std::unordered_map<const Texture *, std::string> m_backendKeys;	// backend -> key, for reloading
+	std::vector<std::string> m_reloads;	// keys of the evicted textures used in Draw, reloaded by NextFrame
+	TextureCacheStats m_textureCacheStats = {};
+	// Models uploaded by reference, See UploadModel
+	ModelUpload *m_upload = nullptr;
+	std::vector<ModelUpload *> m_uploads;
+	// Last submitted values, indexed by uniform handle. Only used when m_uniformCache is true.
+	struct UniformValue {
+		bool valid = false;
+		std::vector<uint8_t> data;
+	};
+	std::vector<UniformValue> m_uniformValues;
+	bool m_uniformCache = false;
+	FrameStats m_stats = {};
+	uint64_t m_currentState = 0;
+	bool m_stateValid = false;
 
 	const Effekseer::Backend::TextureRef & GetExternalTexture(Effekseer::Backend::TextureRef &t, int type, void *param) const {
 		if (t == nullptr)
@@ -811,20 +1090,26 @@ private:
 		GenVertexLayout(&m_layouts[LAYOUT_ADVLIGHTING].layout, 	EffekseerRenderer::RendererShaderType::AdvancedLit);
 		GenVertexLayout(&m_layouts[LAYOUT_ADVSIMPLE].layout, 	EffekseerRenderer::RendererShaderType::AdvancedUnlit);
 
-// todo : materials
+		GenMaterialLayout(&m_layouts[MaterialLayout(true, 0, 0)].layout, true, 0, 0);
+		int cd1, cd2;
+		for (cd1=0;cd1<LAYOUT_MATERIAL_CUSTOMDATA;cd1++) {
+			for (cd2=0;cd2<LAYOUT_MATERIAL_CUSTOMDATA;cd2++) {
+				GenMaterialLayout(&m_layouts[MaterialLayout(false, cd1, cd2)].layout, false, cd1, cd2);
+			}
+		}
 	}
 	void InitVertexBuffer() {
 		m_vertexBuffer = new DummyVertexBuffer;
 	}
-	void SetPixelConstantBuffer(Shader *shaders[]) const {
-		for (auto t: {
-			EffekseerRenderer::RendererShaderType::Unlit,
-			EffekseerRenderer::RendererShaderType::Lit,
-			EffekseerRenderer::RendererShaderType::AdvancedUnlit,
-			EffekseerRenderer::RendererShaderType::AdvancedLit,
-		}) {
-			int id = (int)t;
-			Shader * s = shaders[id];
+	RendererImplemented * Root() {
+		return m_parent ? m_parent : this;
+	}
+	const RendererImplemented * Root() const {
+		return m_parent ? m_parent : this;
+	}
+	void SetPixelConstantBuffer(Shader *s, EffekseerRenderer::RendererShaderType t) const {
+		if (t != EffekseerRenderer::RendererShaderType::BackDistortion
+			&& t != EffekseerRenderer::RendererShaderType::AdvancedBackDistortion) {
 			s->SetPixelConstantBufferSize(sizeof(EffekseerRenderer::PixelConstantBuffer));
 #define PUNIFORM(uname, fname) AddUniform(s, #uname, Shader::UniformType::Pixel, offsetof(EffekseerRenderer::PixelConstantBuffer, fname));
 			PUNIFORM(u_fsfLightDirection, 		LightDirection)
@@ -846,13 +1131,7 @@ private:
 			PUNIFORM(u_fsmUVInversedBack, 		UVInversedBack)
 			PUNIFORM(u_fsmiscFlags, 			MiscFlags)
 #undef PUNIFORM
-		}
-		for (auto t: {
-			EffekseerRenderer::RendererShaderType::BackDistortion,
-			EffekseerRenderer::RendererShaderType::AdvancedBackDistortion,
-		}) {
-			int id = (int)t;
-			Shader * s = shaders[id];
+		} else {
 			s->SetPixelConstantBufferSize(sizeof(EffekseerRenderer::PixelConstantBufferDistortion));
 #define PUNIFORM(uname, fname) AddUniform(s, #uname, Shader::UniformType::Pixel, offsetof(EffekseerRenderer::PixelConstantBufferDistortion, fname));
 			PUNIFORM(u_fsg_scale, 				DistortionIntencity)
@@ -866,8 +1145,7 @@ private:
 #undef PUNIFORM
 		}
 	}
-
-	void SetSamplers(Shader *shaders[]){
+	void SetSamplers(Shader *s, EffekseerRenderer::RendererShaderType t){
 		const uint32_t shaderCount = (uint32_t)EffekseerRenderer::RendererShaderType::Material;
 		
 		const int32_t alphaSlot[shaderCount] 			= {-1, -1, -1, 1, 2, 2};
@@ -876,90 +1154,214 @@ private:
 		const int32_t blendAlphaSlot[shaderCount] 		= {-1, -1, -1, 4, 5, 5};
 		const int32_t blendUVDistortionSlot[shaderCount]= {-1, -1, -1, 5, 6, 6};
 		const int32_t depthSlot[shaderCount] 			= { 1,  2,  2, 6, 7, 7,};
-		for (auto t : {
-			EffekseerRenderer::RendererShaderType::Unlit,
-			EffekseerRenderer::RendererShaderType::Lit,
-			EffekseerRenderer::RendererShaderType::BackDistortion,
-			EffekseerRenderer::RendererShaderType::AdvancedUnlit,
-			EffekseerRenderer::RendererShaderType::AdvancedLit,
-			EffekseerRenderer::RendererShaderType::AdvancedBackDistortion,
-		}) {
-			const int32_t idx = (int)t;
-			auto s = shaders[idx];
+		const int32_t idx = (int)t;
 #define UTEXTURE(uname, slotidx)	AddUniform(s, #uname, Shader::UniformType::Texture, slotidx);
-			//AddUniform(s, "s_colorTex", Shader::UniformType::Texture, 0);
-			UTEXTURE(s_colorTex, 				0);
-			UTEXTURE(s_backTex, 				1);
-			UTEXTURE(s_normalTex, 				1);
-			UTEXTURE(s_alphaTex, 				alphaSlot[idx]);
-			UTEXTURE(s_uvDistortionTex, 		uvDistortionSlot[idx]);
-			UTEXTURE(s_blendTex, 				blendSlot[idx]);
-			UTEXTURE(s_blendAlphaTex, 			blendAlphaSlot[idx]);
-			UTEXTURE(s_blendUVDistortionTex, 	blendUVDistortionSlot[idx]);
-			UTEXTURE(s_depthTex, 				depthSlot[idx]);
+		//AddUniform(s, "s_colorTex", Shader::UniformType::Texture, 0);
+		UTEXTURE(s_colorTex, 				0);
+		UTEXTURE(s_backTex, 				1);
+		UTEXTURE(s_normalTex, 				1);
+		UTEXTURE(s_alphaTex, 				alphaSlot[idx]);
+		UTEXTURE(s_uvDistortionTex, 		uvDistortionSlot[idx]);
+		UTEXTURE(s_blendTex, 				blendSlot[idx]);
+		UTEXTURE(s_blendAlphaTex, 			blendAlphaSlot[idx]);
+		UTEXTURE(s_blendUVDistortionTex, 	blendUVDistortionSlot[idx]);
+		UTEXTURE(s_depthTex, 				depthSlot[idx]);
 #undef UTEXTURE
+	}
+	static const char * BuiltinShaderName(EffekseerRenderer::RendererShaderType t, bool model) {
+		static const char *name[2][SHADERCOUNT] = {
+			{ "sprite_unlit", "sprite_lit", "sprite_distortion", "sprite_adv_unlit", "sprite_adv_lit", "sprite_adv_distortion" },
+			{ "model_unlit", "model_lit", "model_distortion", "model_adv_unlit", "model_adv_lit", "model_adv_distortion" },
+		};
+		static_assert((int)EffekseerRenderer::RendererShaderType::Unlit == 0
+			&& (int)EffekseerRenderer::RendererShaderType::Lit == 1
+			&& (int)EffekseerRenderer::RendererShaderType::BackDistortion == 2
+			&& (int)EffekseerRenderer::RendererShaderType::AdvancedUnlit == 3
+			&& (int)EffekseerRenderer::RendererShaderType::AdvancedLit == 4
+			&& (int)EffekseerRenderer::RendererShaderType::AdvancedBackDistortion == 5, "Invalid shader type order");
+		return name[model][(int)t];
+	}
+	// The built-in programs are created on first use (See GetShader/GetModelShader), or by PrewarmShaders.
+	Shader * CreateSpriteShader(EffekseerRenderer::RendererShaderType t) {
+		const char *shadername = BuiltinShaderName(t, false);
+		Shader * s = CreateShader();
+		if (!InitShader(s,
+			LoadShader(NULL, shadername, "vs"),
+			LoadShader(NULL, shadername, "fs"))){
+			delete s;
+			return nullptr;
+		}
+		s->SetVertexConstantBufferSize(sizeof(EffekseerRenderer::StandardRendererVertexBuffer));
+		AddUniform(s, "u_mCamera", Shader::UniformType::Vertex,
+			offsetof(EffekseerRenderer::StandardRendererVertexBuffer, constantVSBuffer[0]));
+		AddUniform(s, "u_mCameraProj", Shader::UniformType::Vertex,
+			offsetof(EffekseerRenderer::StandardRendererVertexBuffer, constantVSBuffer[1]));
+		AddUniform(s, "u_mUVInversed", Shader::UniformType::Vertex,
+			offsetof(EffekseerRenderer::StandardRendererVertexBuffer, uvInversed));
+		AddUniform(s, "u_mflipbookParameter", Shader::UniformType::Vertex,
+			offsetof(EffekseerRenderer::StandardRendererVertexBuffer, flipbookParameter));
+		SetPixelConstantBuffer(s, t);
+		SetSamplers(s, t);
+		return s;
+	}
+	Shader * CreateModelShader(EffekseerRenderer::RendererShaderType t) {
+		const char *shadername = BuiltinShaderName(t, true);
+		Shader * s = CreateShader();
+		if (!InitShader(s,
+			LoadShader(NULL, shadername, "vs"),
+			LoadShader(NULL, shadername, "fs"))){
+			delete s;
+			return nullptr;
+		}
+		if (t == EffekseerRenderer::RendererShaderType::Unlit
+			|| t == EffekseerRenderer::RendererShaderType::Lit
+			|| t == EffekseerRenderer::RendererShaderType::BackDistortion) {
+			typedef EffekseerRenderer::ModelRendererVertexConstantBuffer<MaxInstanced> VCB;
+			s->SetVertexConstantBufferSize(sizeof(VCB));
+			s->m_modelMatrixOffset = offsetof(VCB, ModelMatrix);
+			s->m_modelUVOffset = offsetof(VCB, ModelUV);
+			s->m_modelColorOffset = offsetof(VCB, ModelColor);
+#define VUNIFORM(uname, fname) AddUniform(s, #uname, Shader::UniformType::Vertex, offsetof(VCB, fname));
+				VUNIFORM(u_mCameraProj, 	CameraMatrix)
+				VUNIFORM(u_mModel_Inst, 	ModelMatrix)
+				VUNIFORM(u_fUV, 			ModelUV)
+				VUNIFORM(u_fModelColor, 	ModelColor)
+				VUNIFORM(u_fLightDirection,	LightDirection)
+				VUNIFORM(u_fLightColor, 	LightColor)
+				VUNIFORM(u_fLightAmbient, 	LightAmbientColor)
+				VUNIFORM(u_mUVInversed, 	UVInversed)
+#undef VUNIFORM
+		} else {
+			typedef EffekseerRenderer::ModelRendererAdvancedVertexConstantBuffer<MaxInstanced> VCB;
+			s->SetVertexConstantBufferSize(sizeof(VCB));
+#define VUNIFORM(uname, fname) AddUniform(s, #uname, Shader::UniformType::Vertex, offsetof(VCB, fname));
+				VUNIFORM(u_mCameraProj, 		CameraMatrix)
+				VUNIFORM(u_mModel_Inst, 		ModelMatrix)
+				VUNIFORM(u_fUV, 				ModelUV)
+				VUNIFORM(u_fAlphaUV, 			ModelAlphaUV)
+				VUNIFORM(u_fUVDistortionUV, 	ModelUVDistortionUV)
+				VUNIFORM(u_fBlendUV, 			ModelBlendUV)
+				VUNIFORM(u_fBlendAlphaUV, 		ModelBlendAlphaUV)
+				VUNIFORM(u_fBlendUVDistortionUV,ModelBlendUVDistortionUV)
+				VUNIFORM(u_fFlipbookParameter, 	ModelFlipbookParameter)
+				VUNIFORM(u_fFlipbookIndexAndNextRate, ModelFlipbookIndexAndNextRate)
+				VUNIFORM(u_fModelAlphaThreshold,ModelAlphaThreshold)
+				VUNIFORM(u_fModelColor, 		ModelColor)
+				VUNIFORM(u_fLightDirection, 	LightDirection)
+				VUNIFORM(u_fLightColor, 		LightColor)
+				VUNIFORM(u_fLightAmbient, 	LightAmbientColor)
+				VUNIFORM(u_mUVInversed, 		UVInversed)
+#undef VUNIFORM
+		}
+		SetPixelConstantBuffer(s, t);
+		SetSamplers(s, t);
+		CreateInstancedModelShader(s, t);
+		return s;
+	}
+	// The instanced variants are optional, use uniform arrays (MaxInstanced per draw call) if shader_load doesn't offer them.
+	void CreateInstancedModelShader(Shader *base, EffekseerRenderer::RendererShaderType t) {
+		const char *shadername = NULL;
+		switch (t) {
+		case EffekseerRenderer::RendererShaderType::Unlit :
+			shadername = "model_unlit_inst";
+			break;
+		case EffekseerRenderer::RendererShaderType::Lit :
+			shadername = "model_lit_inst";
+			break;
+		case EffekseerRenderer::RendererShaderType::BackDistortion :
+			shadername = "model_distortion_inst";
+			break;
+		default:
+			return;
+		}
+		Shader *s = CreateShader();
+		if (!InitShader(s,
+			LoadShader(NULL, shadername, "vs"),
+			LoadShader(NULL, shadername, "fs"))) {
+			delete s;
+			return;
 		}
+		s->SetVertexConstantBufferSize(base->m_vcbSize);
+		s->SetPixelConstantBufferSize(base->m_pcbSize);
+		CopyUniforms(s, base);
+		base->m_instanced = s;
+	}
+	// Returns the built-in shader of this renderer, the workers clone the ones of the root.
+	Shader * GetBuiltinShader(int n, bool model) {
+		Shader **shaders = model ? m_modelShaders : m_shaders;
+		if (m_parent == nullptr) {
+			const uint32_t bit = 1u << (model ? SHADERCOUNT + n : n);
+			if (!(m_builtinReady.load(std::memory_order_acquire) & bit) && !CreateBuiltinShader(n, model))
+				return nullptr;
+			return shaders[n];
+		}
+		if (shaders[n] == nullptr) {
+			Shader *s = m_parent->GetBuiltinShader(n, model);
+			if (s == nullptr)
+				return nullptr;
+			shaders[n] = CloneShader(s);
+		}
+		return shaders[n];
 	}
-	bool InitShaders(struct InitArgs *init) {
-		m_initArgs = *init;
-		for (auto t : {
-			EffekseerRenderer::RendererShaderType::Unlit,
-			EffekseerRenderer::RendererShaderType::Lit,
-			EffekseerRenderer::RendererShaderType::BackDistortion,
-			EffekseerRenderer::RendererShaderType::AdvancedUnlit,
-			EffekseerRenderer::RendererShaderType::AdvancedLit,
-			EffekseerRenderer::RendererShaderType::AdvancedBackDistortion,
-		}) {
-			Shader * s = new Shader(this);
-			int id = (int)t;
-			m_shaders[id] = s;
-//			uint32_t depthTexSlot = 1;
-			const char *shadername = NULL;
-			switch (t) {
-			case EffekseerRenderer::RendererShaderType::Unlit :
-				shadername = "sprite_unlit";
-				break;
-			case EffekseerRenderer::RendererShaderType::Lit :
-				shadername = "sprite_lit";
-				break;
-			case EffekseerRenderer::RendererShaderType::BackDistortion :
-				shadername = "sprite_distortion";
-				break;
-			case EffekseerRenderer::RendererShaderType::AdvancedUnlit :
-				shadername = "sprite_adv_unlit";
-				break;
-			case EffekseerRenderer::RendererShaderType::AdvancedLit :
-				shadername = "sprite_adv_lit";
-				break;
-			case EffekseerRenderer::RendererShaderType::AdvancedBackDistortion :
-				shadername = "sprite_adv_distortion";
-				break;
-			default:
-				assert(false);
-				break;
-			}
-			if (!InitShader(s,
-				LoadShader(NULL, shadername, "vs"),
-				LoadShader(NULL, shadername, "fs"))){
-				return false;
-			}
-			s->SetVertexConstantBufferSize(sizeof(EffekseerRenderer::StandardRendererVertexBuffer));
-			AddUniform(s, "u_mCamera", Shader::UniformType::Vertex,
-				offsetof(EffekseerRenderer::StandardRendererVertexBuffer, constantVSBuffer[0]));
-			AddUniform(s, "u_mCameraProj", Shader::UniformType::Vertex,
-				offsetof(EffekseerRenderer::StandardRendererVertexBuffer, constantVSBuffer[1]));
-			AddUniform(s, "u_mUVInversed", Shader::UniformType::Vertex,
-				offsetof(EffekseerRenderer::StandardRendererVertexBuffer, uvInversed));
-			AddUniform(s, "u_mflipbookParameter", Shader::UniformType::Vertex,
-				offsetof(EffekseerRenderer::StandardRendererVertexBuffer, flipbookParameter));
-		}
-		SetPixelConstantBuffer(m_shaders);
-		SetSamplers(m_shaders);
+	// Root only. A program which can't be loaded is not tried again.
+	bool CreateBuiltinShader(int n, bool model) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		const uint32_t bit = 1u << (model ? SHADERCOUNT + n : n);
+		if (m_builtinReady.load(std::memory_order_relaxed) & bit)
+			return true;
+		if (m_builtinFailed & bit)
+			return false;
+		auto t = (EffekseerRenderer::RendererShaderType)n;
+		Shader *s = model ? CreateModelShader(t) : CreateSpriteShader(t);
+		if (s == nullptr) {
+			m_builtinFailed |= bit;
+			return false;
+		}
+		(model ? m_modelShaders : m_shaders)[n] = s;
+		m_builtinReady.fetch_or(bit, std::memory_order_release);
 		return true;
 	}
-	void InitTextures(struct InitArgs *init) {
-		if (init->texture_get == nullptr)
+	// The instanced variant of material model shader (model_inst / model_refraction_inst) is optional too.
+	void CreateInstancedMaterialShader(Shader *base, const char *matpath, int st) {
+		static const char *shadername[2] = {
+			"model_inst",
+			"model_refraction_inst",
+		};
+		Shader *s = new Shader(this);
+		if (!InitShader(s,
+			LoadShader(matpath, shadername[st], "vs"),
+			LoadShader(matpath, shadername[st], "fs"))) {
+			delete s;
 			return;
+		}
+		s->SetVertexConstantBufferSize(base->m_vcbSize);
+		s->SetPixelConstantBufferSize(base->m_pcbSize);
+		CopyUniforms(s, base);
+		base->m_instanced = s;
+	}
+	// Bind the uniforms of `s` by the names and offsets of `source`
+	void CopyUniforms(Shader *s, const Shader *source) const {
+		for (const auto &it : source->m_uniformIndex) {
+			const char *name = it.first.c_str();
+			for (int i : { it.second.vs, it.second.fs }) {
+				if (i < 0)
+					continue;
+				const auto &u = source->m_uniform[i];
+				if (u.count == 0)
+					continue;
+				const uint8_t *ptr = (const uint8_t *)u.ptr;
+				if (ptr == nullptr) {
+					AddUniform(s, name, Shader::UniformType::Texture, u.count - 1);
+				} else if (i < source->m_vsSize) {
+					AddUniform(s, name, Shader::UniformType::Vertex, (int)(ptr - source->m_vcbBuffer));
+				} else {
+					AddUniform(s, name, Shader::UniformType::Pixel, (int)(ptr - source->m_pcbBuffer));
+				}
+			}
+		}
+	}
+	void InitTextures(struct InitArgs *init) {
+		// The handles are offered by texture_get or the capture (See SetCapture), they are not owned by the renderer
 		bgfx_texture_handle_t invalid = BGFX_INVALID_HANDLE;
 		m_background = Effekseer::MakeRefPtr<Texture>(this, invalid);
 		m_depth = Effekseer::MakeRefPtr<Texture>(this, invalid);
@@ -967,13 +1369,50 @@ private:
 public:
 	RendererImplemented() {
 		m_device = Effekseer::MakeRefPtr<GraphicsDevice>(this);
+		m_capture.viewid = 0;
+		m_capture.width = 0;
+		m_capture.height = 0;
 		int i;
+		for (auto &target : m_capture.target) {
+			target.src = BGFX_INVALID_HANDLE;
+			target.dst = BGFX_INVALID_HANDLE;
+			target.frame = 0;
+		}
 		for (i=0;i<SHADERCOUNT;i++) {
 			m_shaders[i] = nullptr;
+			m_modelShaders[i] = nullptr;
 		}
+		for (i=0;i<LAYOUT_COUNT;i++) {
+			m_layouts[i].handle = BGFX_INVALID_HANDLE;
+			m_rings[i].handle = BGFX_INVALID_HANDLE;
+			m_rings[i].data = nullptr;
+		}
+		m_frame = 0;
 	}
 	~RendererImplemented() {
 		GetImpl()->DeleteProxyTextures(this);
+		for (auto upload : m_uploads) {
+			if (upload->pending.load(std::memory_order_acquire) == 1) {
+				delete upload;
+				continue;
+			}
+			// bgfx still references the arrays of the model, so keep the model until the last ModelUpload::Release.
+			// The buffers are destroyed now, then it's safe to delete the model in the render thread.
+			DetachModel(upload->model);
+			if (upload->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete upload;
+		}
+		// Don't destroy the host textures or the captures
+		if (m_background != nullptr)
+			m_background.DownCast<Texture>()->RemoveInterface();
+		if (m_depth != nullptr)
+			m_depth.DownCast<Texture>()->RemoveInterface();
+		if (m_parent == nullptr) {
+			for (auto &target : m_capture.target) {
+				if (BGFX_HANDLE_IS_VALID(target.dst))
+					BGFX(destroy_texture)(target.dst);
+			}
+		}
 
 		ES_SAFE_DELETE(m_distortingCallback);
 		ES_SAFE_DELETE(m_standardRenderer);
@@ -981,8 +1420,27 @@ public:
 		for (auto shader : m_shaders) {
 			ES_SAFE_DELETE(shader);
 		}
+		for (auto shader : m_modelShaders) {
+			ES_SAFE_DELETE(shader);
+		}
+		ClearClones();
+		for (auto &ring : m_rings) {
+			if (BGFX_HANDLE_IS_VALID(ring.handle))
+				BGFX(destroy_dynamic_vertex_buffer)(ring.handle);
+			delete[] ring.data;
+		}
+		if (m_parent == nullptr) {
+			for (auto &layout : m_layouts) {
+				if (BGFX_HANDLE_IS_VALID(layout.handle))
+					BGFX(destroy_vertex_layout)(layout.handle);
+			}
+			if (BGFX_HANDLE_IS_VALID(m_modellayoutHandle))
+				BGFX(destroy_vertex_layout)(m_modellayoutHandle);
+		}
 		ES_SAFE_DELETE(m_indexBuffer);
 		ES_SAFE_DELETE(m_vertexBuffer);
+		if (m_parent)
+			m_parent->Release();
 	}
 
 	void OnLostDevice() override {}
@@ -990,12 +1448,15 @@ public:
 
 	bool Initialize(struct InitArgs *init) {
 		m_bgfx = init->bgfx;
-		if (!InitShaders(init)) {
-			return false;
-		}
+		m_initArgs = *init;
 		InitTextures(init);
+		m_textureSlots = std::vector<TextureSlot>(MAX_TEXTURE_ID);
 		InitVertexLayout();
 		m_viewid = init->viewid;
+		m_homogeneousDepth = BGFX(get_caps)()->homogeneousDepth;
+		m_uniformCache = init->sequentialView;
+		SetVertexBufferMode(init->vertexBufferMode);
+		SetDistortionMode(init->distortionMode);
 		m_squareMaxCount = init->squareMaxCount;
 		if (GetIndexSpriteCount() * 4 > 65536) {
 			m_indexBufferStride = 4;
@@ -1010,11 +1471,233 @@ public:
 		GetImpl()->CreateProxyTextures(this);
 		return true;
 	}
+	bool InitializeWorker(RendererImplemented *parent) {
+		if (parent->m_parent)
+			parent = parent->m_parent;
+		parent->AddRef();
+		m_parent = parent;
+		// The draw calls of the root interleave with the workers' ones too, so stop caching its uniforms.
+		parent->m_uniformCache = false;
+		parent->InvalidateUniforms();
+
+		m_bgfx = parent->m_bgfx;
+		m_initArgs = parent->m_initArgs;
+		m_viewid = parent->m_viewid;
+		m_homogeneousDepth = parent->m_homogeneousDepth;
+		// The draw calls of workers interleave in the view, so the uniforms must be submitted every time.
+		m_uniformCache = false;
+		SetDistortionMode(m_initArgs.distortionMode);
+		m_modellayout = parent->m_modellayout;
+		int i;
+		for (i=0; i<LAYOUT_COUNT; ++i) {
+			m_layouts[i].layout = parent->m_layouts[i].layout;
+		}
+		InitTextures(&m_initArgs);
+		InitVertexBuffer();
+		m_renderState = new RenderState(this, m_initArgs.invz);
+
+		m_standardRenderer = new BGFXStandardRenderer(this);
+
+		GetImpl()->isSoftParticleEnabled = true;
+		GetImpl()->CreateProxyTextures(this);
+		return true;
+	}
+	// Create all the built-in shaders now, instead of on first use. Returns false if any of them can't be loaded.
+	bool PrewarmShaders() {
+		bool ok = true;
+		for (int i=0; i<SHADERCOUNT; ++i) {
+			ok = (GetBuiltinShader(i, false) != nullptr) && ok;
+			ok = (GetBuiltinShader(i, true) != nullptr) && ok;
+		}
+		return ok;
+	}
+	// The shaders and layouts used by the nodes of an effect.
+	struct PrewarmNeeds {
+		bool sprites[SHADERCOUNT];
+		bool models[SHADERCOUNT];
+		bool layouts[LAYOUT_COUNT];
+		bool modelLayout;
+	};
+	void CollectNeeds(const Effekseer::Effect *effect, const Effekseer::EffectNode *node, PrewarmNeeds &needs) const {
+		const auto type = node->GetType();
+		if (type != Effekseer::EffectNodeType::Root && type != Effekseer::EffectNodeType::NoneType) {
+			const bool model = type == Effekseer::EffectNodeType::Model;
+			const auto param = node->GetBasicRenderParameter();
+			int base = -1;
+			switch (param.MaterialType) {
+			case Effekseer::RendererMaterialType::Default :
+				base = (int)EffekseerRenderer::RendererShaderType::Unlit;
+				break;
+			case Effekseer::RendererMaterialType::Lighting :
+				base = (int)EffekseerRenderer::RendererShaderType::Lit;
+				break;
+			case Effekseer::RendererMaterialType::BackDistortion :
+				base = (int)EffekseerRenderer::RendererShaderType::BackDistortion;
+				break;
+			case Effekseer::RendererMaterialType::File : {
+				// The shaders of user defined materials are created by MaterialLoader
+				auto material = effect->GetMaterial(param.MaterialIndex);
+				if (material != nullptr && !model)
+					needs.layouts[MaterialLayout(material->IsSimpleVertex, material->CustomData1, material->CustomData2)] = true;
+				break;
+			}
+			default:
+				break;
+			}
+			if (base >= 0) {
+				// The advanced variant is selected by the parameters at runtime, so prepare both
+				const int advanced = base + (int)EffekseerRenderer::RendererShaderType::AdvancedUnlit;
+				bool *shaders = model ? needs.models : needs.sprites;
+				shaders[base] = true;
+				shaders[advanced] = true;
+				if (!model) {
+					needs.layouts[SpriteLayout((EffekseerRenderer::RendererShaderType)base)] = true;
+					needs.layouts[SpriteLayout((EffekseerRenderer::RendererShaderType)advanced)] = true;
+				}
+			}
+			needs.modelLayout = needs.modelLayout || model;
+		}
+		for (int i=0; i<node->GetChildrenCount(); ++i) {
+			CollectNeeds(effect, node->GetChild(i), needs);
+		}
+	}
+	// Create the resources used by an effect, which are created on first use otherwise.
+	bool Prewarm(const Effekseer::Effect *effect, PrewarmReport *report) {
+		typedef std::chrono::steady_clock Clock;
+		auto elapsed = [](Clock::time_point from) {
+			return std::chrono::duration<double, std::micro>(Clock::now() - from).count();
+		};
+		*report = {};
+		PrewarmNeeds needs = {};
+		CollectNeeds(effect, effect->GetRoot(), needs);
+
+		auto t = Clock::now();
+		RendererImplemented *root = Root();
+		for (int i=0; i<SHADERCOUNT; ++i) {
+			for (int model = 0; model < 2; ++model) {
+				if (!(model ? needs.models[i] : needs.sprites[i]))
+					continue;
+				const uint32_t bit = 1u << (model ? SHADERCOUNT + i : i);
+				const bool ready = (root->m_builtinReady.load(std::memory_order_acquire) & bit) != 0;
+				if (GetBuiltinShader(i, model != 0) == nullptr)
+					++report->failures;
+				else if (!ready)
+					++report->programs;
+			}
+		}
+		for (int i=0; i<effect->GetMaterialCount(); ++i) {
+			auto material = effect->GetMaterial(i);
+			if (material == nullptr)
+				continue;
+			if (material->UserPtr != nullptr)
+				++report->materialsReady;
+			else
+				++report->failures;
+		}
+		report->programTime = elapsed(t);
+
+		t = Clock::now();
+		auto storeModel = [this, report](Effekseer::ModelRef model) {
+			if (model == nullptr || model->GetIsBufferStoredOnGPU())
+				return;
+			if (StoreModelToGPU(model))
+				++report->models;
+			else
+				++report->failures;
+		};
+		for (int i=0; i<effect->GetModelCount(); ++i) {
+			storeModel(effect->GetModel(i));
+		}
+		for (int i=0; i<effect->GetProceduralModelCount(); ++i) {
+			storeModel(effect->GetProceduralModel(i));
+		}
+		report->modelTime = elapsed(t);
+
+		t = Clock::now();
+		if (needs.modelLayout) {
+			bool created;
+			{
+				std::lock_guard<std::mutex> lock(root->m_lock);
+				created = !BGFX_HANDLE_IS_VALID(root->m_modellayoutHandle);
+			}
+			if (BGFX_HANDLE_IS_VALID(GetModelLayoutHandle()) && created)
+				++report->layouts;
+		}
+		// The transient buffers are allocated per frame, only the dynamic vertex buffers can be created now
+		if (IsDynamic()) {
+			for (int i=0; i<LAYOUT_COUNT; ++i) {
+				if (!needs.layouts[i] || BGFX_HANDLE_IS_VALID(root->m_rings[i].handle))
+					continue;
+				if (root->CreateRing(i))
+					++report->layouts;
+				else
+					++report->failures;
+			}
+		}
+		report->layoutTime = elapsed(t);
+
+		t = Clock::now();
+		const uint32_t frame = root->m_frame.load(std::memory_order_relaxed);
+		auto resolveTexture = [this, report, frame](const Effekseer::TextureRef &texture) {
+			if (texture == nullptr)
+				return;
+			auto tex = texture->GetBackend().DownCast<Texture>();
+			if (tex == nullptr)
+				return;
+			uint32_t generation;
+			int id = tex->GetId(&generation);
+			// Count only the textures resolved by this call
+			bool resolved = false;
+			if (id < 0 && tex->IsEvicted()) {
+				// Prewarm runs in the thread which calls NextFrame, so it can load it now
+				id = ReloadTexture(tex.Get(), &generation);
+				resolved = true;
+			}
+			bgfx_texture_handle_t handle;
+			if (id < 0) {
+				handle = tex->GetInterface();
+			} else {
+				tex->Touch(frame);
+				resolved = resolved || !HasTextureHandle(id, generation);
+				// texture_handle may create the texture now
+				handle = TextureHandle(id, generation);
+			}
+			if (!BGFX_HANDLE_IS_VALID(handle))
+				++report->texturesPending;
+			else if (resolved)
+				++report->textures;
+		};
+		for (int i=0; i<effect->GetColorImageCount(); ++i) {
+			resolveTexture(effect->GetColorImage(i));
+		}
+		for (int i=0; i<effect->GetNormalImageCount(); ++i) {
+			resolveTexture(effect->GetNormalImage(i));
+		}
+		for (int i=0; i<effect->GetDistortionImageCount(); ++i) {
+			resolveTexture(effect->GetDistortionImage(i));
+		}
+		report->textureTime = elapsed(t);
+		return report->failures == 0;
+	}
 	void SetRestorationOfStatesFlag(bool flag) override {
 		m_restorationOfStates = flag;
 	}
 	bool BeginRendering() override {
-		m_encoder = BGFX(encoder_begin)(false);
+		if (m_parent == nullptr) {
+			CollectUploads();
+			NextCaptureFrame();
+		}
+		m_encoder = BGFX(encoder_begin)(m_parent != nullptr);
+		m_stats = {};
+		m_stateValid = false;
+		m_backgroundGrabbed = false;
+		m_backgroundValid = false;
+		m_currentVertexBuffer.idx = UINT16_MAX;
+		m_currentIndexBuffer.idx = UINT16_MAX;
+		if (m_clones.size() > MAX_CLONES)
+			ClearClones();
+		// Other draw calls in the view may change the uniforms between two BeginRendering
+		InvalidateUniforms();
 		GetImpl()->CalculateCameraProjectionMatrix();
 
 		m_renderState->GetActiveState().Reset();
@@ -1024,9 +1707,12 @@ public:
 
 		int i;
 		for (i=0; i<LAYOUT_COUNT; ++i){
-			m_layouts[i].offset = 0;
-			m_layouts[i].count = 0;
-			m_layouts[i].cap = 0;
+			auto &layout = m_layouts[i];
+			layout.offset = 0;
+			layout.count = 0;
+			layout.cap = 0;
+			layout.hint = layout.total > 0 ? layout.total : layout.hint / 2;
+			layout.total = 0;
 		}
 		m_current_layout = 0;
 
@@ -1034,19 +1720,43 @@ public:
 	}
 	bool EndRendering() override {
 		m_standardRenderer->ResetAndRenderingIfRequired();
+		// Don't leave our render state to the other draw calls of the encoder
+		BGFX(encoder_discard)(m_encoder, BGFX_DISCARD_STATE);
 		BGFX(encoder_end)(m_encoder);
 		return true;
 	}
+	// The mode is shared by the workers, switch it between frames
+	void SetVertexBufferMode(int mode) {
+		Root()->m_dynamic.store(mode == VERTEX_BUFFER_DYNAMIC, std::memory_order_relaxed);
+	}
+	bool IsDynamic() const {
+		return Root()->m_dynamic.load(std::memory_order_relaxed);
+	}
+	void NextFrame() {
+		RendererImplemented *root = Root();
+		++root->m_frame;
+		root->ReloadTextures();
+		root->EvictTextures();
+		root->CollectUploads();
+		root->CreateWantedRings();
+	}
+	void GetFrameStats(FrameStats *stats) const {
+		*stats = m_stats;
+	}
 	DummyVertexBuffer* GetVertexBuffer() {
 		return m_vertexBuffer;
 	}
 	StaticIndexBuffer* GetIndexBuffer() {
-		return m_indexBuffer;
+		return Root()->m_indexBuffer;
 	}
 	int32_t GetSquareMaxCount() const override {
-		return m_squareMaxCount;
+		return Root()->m_squareMaxCount;
 	}
 	void SetSquareMaxCount(int32_t count) override {
+		if (m_parent) {
+			m_parent->SetSquareMaxCount(count);
+			return;
+		}
 		m_squareMaxCount = count;
 		InitIndexBuffer();
 	}
@@ -1073,100 +1783,339 @@ public:
 		return Effekseer::MakeRefPtr<TextureLoader>(this, &m_initArgs);
 	}
 	Effekseer::ModelLoaderRef CreateModelLoader(::Effekseer::FileInterfaceRef fileInterface = nullptr) {
-		// todo: add our model loader (model loader callback in InitArgs)
-		return Effekseer::MakeRefPtr<EffekseerRenderer::ModelLoader>(m_device, fileInterface);
+		return Effekseer::MakeRefPtr<ModelLoader>(this, &m_initArgs, fileInterface);
 	}
 	Effekseer::MaterialLoaderRef CreateMaterialLoader(::Effekseer::FileInterfaceRef fileInterface = nullptr) {
-		return Effekseer::MakeRefPtr<MaterialLoader>(this, fileInterface);
+		return Effekseer::MakeRefPtr<MaterialLoader>(this, &m_initArgs, fileInterface);
 	}
+	// No side effect, the state changes when the callback is really called. See GrabBackground
 	EffekseerRenderer::DistortingCallback* GetDistortingCallback() override {
-		return m_distortingCallback;
+		if (m_distortingCallback == nullptr)
+			return nullptr;
+		if (m_distortionMode == DISTORTION_ONCE_PER_FRAME && m_backgroundGrabbed)
+			return nullptr;	// Use the background grabbed in this frame
+		return &m_distortingProxy;
+	}
+	bool GrabBackground(EffekseerRenderer::Renderer* renderer) {
+		if (m_distortionMode == DISTORTION_ONCE_PER_FRAME)
+			m_backgroundGrabbed = true;
+		// The callback may submit with the same encoder, so the render state should be set again.
+		m_stateValid = false;
+		// And it may change the background texture
+		m_backgroundValid = false;
+		// And the uniforms
+		InvalidateUniforms();
+		++m_stats.backgroundGrabs;
+		return m_distortingCallback->OnDistorting(renderer);
+	}
+	bool NeedGrabPerBatch() const {
+		return m_distortingCallback != nullptr && m_distortionMode == DISTORTION_EVERY_BATCH;
+	}
+	void SetDistortionMode(int mode) {
+		m_distortionMode = mode;
 	}
 	void SetDistortingCallback(EffekseerRenderer::DistortingCallback* callback) override {
 		ES_SAFE_DELETE(m_distortingCallback);
 		m_distortingCallback = callback;
 	}
 	const Effekseer::Backend::TextureRef& GetBackground() override {
+		static const Effekseer::Backend::TextureRef none;
+		// Ask texture_get only once until the distorting callback runs
+		if (m_backgroundValid)
+			return m_background;
+		if (IsCaptured(TEXTURE_BACKGROUND)) {
+			m_backgroundValid = true;
+			m_background.DownCast<Texture>()->ReplaceInterface(Capture(TEXTURE_BACKGROUND));
+			return m_background;
+		}
+		if (m_initArgs.texture_get == nullptr)
+			return none;
+		m_backgroundValid = true;
 		return GetExternalTexture(m_background, TEXTURE_BACKGROUND, nullptr);
 	}
 
 	void GetDepth(Effekseer::Backend::TextureRef& texture, EffekseerRenderer::DepthReconstructionParameter& reconstructionParam) override {
+		if (IsCaptured(TEXTURE_DEPTH)) {
+			const Effekseer::Matrix44 proj = Effekseer::SIMD::ToStruct(GetProjectionMatrix());
+			// Map the depth in texture [0, 1] to NDC
+			reconstructionParam.DepthBufferScale = m_homogeneousDepth ? 2.0f : 1.0f;
+			reconstructionParam.DepthBufferOffset = m_homogeneousDepth ? -1.0f : 0.0f;
+			reconstructionParam.ProjectionMatrix33 = proj.Values[2][2];
+			reconstructionParam.ProjectionMatrix34 = proj.Values[2][3];
+			reconstructionParam.ProjectionMatrix43 = proj.Values[3][2];
+			reconstructionParam.ProjectionMatrix44 = proj.Values[3][3];
+			m_depth.DownCast<Texture>()->ReplaceInterface(Capture(TEXTURE_DEPTH));
+			texture = m_depth;
+			return;
+		}
+		if (m_initArgs.texture_get == nullptr) {
+			texture = nullptr;
+			return;
+		}
 		texture = GetExternalTexture(m_depth, TEXTURE_DEPTH, (void *)&reconstructionParam);
 	}
+	bool IsCaptured(int type) const {
+		return BGFX_HANDLE_IS_VALID(Root()->m_capture.target[type].dst);
+	}
+	// Blit the scene texture to the capture for the first user in this frame, the others use the same copy.
+	bgfx_texture_handle_t Capture(int type) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> lock(root->m_lock);
+		auto &capture = root->m_capture;
+		auto &target = capture.target[type];
+		const uint32_t frame = root->m_captureFrame;
+		if (target.frame != frame) {
+			target.frame = frame;
+			BGFX(encoder_blit)(m_encoder, capture.viewid, target.dst, 0, 0, 0, 0, target.src, 0, 0, 0, 0, capture.width, capture.height, 0);
+			if (type == TEXTURE_BACKGROUND)
+				++root->m_captureStats.colorCaptures;
+			else
+				++root->m_captureStats.depthCaptures;
+		}
+		return target.dst;
+	}
+	// A frame of capture is from one BeginRendering of the root renderer to the next, count the skips of the last one.
+	void NextCaptureFrame() {
+		std::lock_guard<std::mutex> lock(m_lock);
+		const auto &color = m_capture.target[TEXTURE_BACKGROUND];
+		const auto &depth = m_capture.target[TEXTURE_DEPTH];
+		if (m_captureFrame > 0) {
+			if (BGFX_HANDLE_IS_VALID(color.dst) && color.frame != m_captureFrame)
+				++m_captureStats.colorSkips;
+			if (BGFX_HANDLE_IS_VALID(depth.dst) && depth.frame != m_captureFrame)
+				++m_captureStats.depthSkips;
+		}
+		++m_captureFrame;
+	}
+	void SetCapture(const CaptureArgs *args) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> lock(root->m_lock);
+		auto &capture = root->m_capture;
+		for (auto &target : capture.target) {
+			if (BGFX_HANDLE_IS_VALID(target.dst))
+				BGFX(destroy_texture)(target.dst);
+			target.src.idx = UINT16_MAX;
+			target.dst.idx = UINT16_MAX;
+			target.frame = 0;
+		}
+		if (args == nullptr)
+			return;
+		capture.viewid = args->viewid;
+		capture.width = args->width;
+		capture.height = args->height;
+		const bgfx_texture_handle_t src[2] = { args->color, args->depth };
+		const bgfx_texture_format_t format[2] = { args->colorFormat, args->depthFormat };
+		for (int i=0;i<2;i++) {
+			if (!BGFX_HANDLE_IS_VALID(src[i]))
+				continue;
+			auto &target = capture.target[i];
+			target.src = src[i];
+			target.dst = BGFX(create_texture_2d)(args->width, args->height, false, 1, format[i], BGFX_TEXTURE_BLIT_DST, nullptr);
+		}
+	}
+	void GetCaptureStats(CaptureStats *stats) const {
+		const RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> lock(root->m_lock);
+		*stats = root->m_captureStats;
+	}
 
 	BGFXStandardRenderer* GetStandardRenderer() {
 		return m_standardRenderer;
 	}
-	void SetVertexBuffer(DummyVertexBuffer* vertexBuffer, int32_t stride) {}
+	void SetVertexBuffer(DummyVertexBuffer* vertexBuffer, int32_t stride) {
+		DrawInstances();
+		m_currentVertexBuffer.idx = UINT16_MAX;
+	}
 	// For ModelRenderer, See ModelRendererBase
 	void SetVertexBuffer(const Effekseer::Backend::VertexBufferRef& vertexBuffer, int32_t stride) {
 		(void)stride;
-		//m_currentVertexBuffer = vertexBuffer.DownCast<StaticVertexBuffer>()->GetInterface();
-		BGFX(encoder_set_vertex_buffer)(m_encoder, 0, vertexBuffer.DownCast<StaticVertexBuffer>()->GetInterface(), 0, UINT32_MAX);
+		bgfx_vertex_buffer_handle_t handle = vertexBuffer.DownCast<StaticVertexBuffer>()->GetInterface();
+		if (handle.idx != m_currentVertexBuffer.idx) {
+			// The instances collected are of another model
+			DrawInstances();
+			m_currentVertexBuffer = handle;
+		}
 	}
 	void SetIndexBuffer(StaticIndexBuffer* indexBuffer) {
-		assert(indexBuffer == m_indexBuffer);
+		assert(indexBuffer == GetIndexBuffer());
+		DrawInstances();
+		m_currentIndexBuffer.idx = UINT16_MAX;
 	}
 	void SetIndexBuffer(const Effekseer::Backend::IndexBufferRef& indexBuffer) {
-		BGFX(encoder_set_index_buffer)(m_encoder, indexBuffer.DownCast<StaticIndexBuffer>()->GetInterface(), 0, UINT32_MAX);
+		bgfx_index_buffer_handle_t handle = indexBuffer.DownCast<StaticIndexBuffer>()->GetInterface();
+		if (handle.idx != m_currentIndexBuffer.idx) {
+			DrawInstances();
+			m_currentIndexBuffer = handle;
+		}
+	}
+	// The buffers are discarded after each submit, so bind them again for every draw call.
+	void BindModelBuffers(uint32_t vertexCount, uint32_t indexCount) {
+		BGFX(encoder_set_vertex_buffer)(m_encoder, 0, m_currentVertexBuffer, 0, vertexCount);
+		BGFX(encoder_set_index_buffer)(m_encoder, m_currentIndexBuffer, 0, indexCount);
+	}
+	// The same for the textures, a batch may be drawn by more than one submit.
+	void BindTextures() {
+		for (int i=0; i<m_textureBindingCount; ++i) {
+			const auto &b = m_textureBindings[i];
+			if (BGFX_HANDLE_IS_VALID(b.sampler)) {
+				BGFX(encoder_set_texture)(m_encoder, (uint8_t)i, b.sampler, b.handle, b.flags);
+				++m_stats.textureBinds;
+			}
+		}
 	}
 	void SetLayout(Shader* shader) {}
 
-	void AllocVertexBuffer() {
+	// Allocate a transient vertex buffer for at least `count` vertices.
+	// The first buffer of a pass is sized by the demand of previous passes, and the following ones grow twice.
+	void AllocVertexBuffer(int count) {
+		auto &info = m_layouts[m_current_layout];
+		info.ring = -1;
+		if (m_parent == nullptr && IsDynamic()) {
+			auto &ring = m_rings[m_current_layout];
+			if (!BGFX_HANDLE_IS_VALID(ring.handle)) {
+				// Don't create it during Draw, use the transient buffer in this frame
+				ring.wanted = true;
+			} else if (AllocRing(count)) {
+				return;
+			}
+			// The segment of this frame is full, fall back to the transient buffer
+		}
+		const int maxCount = 4 * GetSquareMaxCount();
+		assert(count <= maxCount);
+		int cap = info.cap > 0 ? info.cap * 2 : info.hint;
+		cap = (std::max)(cap, count);
+		cap = (std::max)(cap, TRANSIENT_MIN_VERTICES);
+		cap = (std::min)(cap, maxCount);
+		const uint32_t avail = BGFX(get_avail_transient_vertex_buffer)(cap, &info.layout);
+		if (avail < (uint32_t)cap) {
+			cap = (int)avail;
+		}
+		info.offset = 0;
+		info.count = 0;
+		if (cap < count) {
+			// Out of transient vertex buffer
+			info.cap = 0;
+			return;
+		}
+		BGFX(alloc_transient_vertex_buffer)(&info.tvb, cap, &info.layout);
+		info.data = info.tvb.data;
+		info.cap = cap;
+		m_stats.vertexBytesAllocated += cap * info.layout.stride;
+	}
+	// Use the rest of the current segment. Returns false if it's not enough.
+	bool AllocRing(int count) {
 		auto &info = m_layouts[m_current_layout];
+		auto &ring = m_rings[m_current_layout];
+		const uint32_t frame = Root()->m_frame;
+		if (ring.frame != frame) {
+			ring.frame = frame;
+			ring.head = 0;
+		}
+		const int cap = ring.segment - ring.head;
+		if (cap < count)
+			return false;
+		info.ring = (frame % RING_FRAMES) * ring.segment + ring.head;
+		info.data = ring.data + info.ring * info.layout.stride;
 		info.offset = 0;
 		info.count = 0;
-		BGFX(alloc_transient_vertex_buffer)(&info.tvb, info.cap, &info.layout);
+		info.cap = cap;
+		return true;
 	}
 
-	void SwitchLayout(EffekseerRenderer::RendererShaderType renderingMode) {
-		switch (renderingMode) {
+	// The dynamic vertex buffer of a layout is created by Prewarm, or in NextFrame after its first use.
+	void CreateWantedRings() {
+		if (!IsDynamic())
+			return;
+		for (int i=0; i<LAYOUT_COUNT; ++i) {
+			if (m_rings[i].wanted) {
+				m_rings[i].wanted = false;
+				CreateRing(i);
+			}
+		}
+	}
+	bool CreateRing(int id) {
+		auto &ring = m_rings[id];
+		if (BGFX_HANDLE_IS_VALID(ring.handle))
+			return true;
+		const auto &layout = m_layouts[id].layout;
+		ring.segment = 4 * GetSquareMaxCount();
+		ring.handle = BGFX(create_dynamic_vertex_buffer)(ring.segment * RING_FRAMES, &layout, BGFX_BUFFER_NONE);
+		if (!BGFX_HANDLE_IS_VALID(ring.handle))
+			return false;
+		ring.data = new uint8_t[ring.segment * RING_FRAMES * layout.stride];
+		ring.frame = Root()->m_frame - 1;
+		return true;
+	}
+	static int SpriteLayout(EffekseerRenderer::RendererShaderType t) {
+		switch (t) {
 		case EffekseerRenderer::RendererShaderType::Lit :
 		case EffekseerRenderer::RendererShaderType::BackDistortion :
-			m_current_layout = LAYOUT_LIGHTING;
-			break;
+			return LAYOUT_LIGHTING;
 		case EffekseerRenderer::RendererShaderType::Unlit :
-			m_current_layout = LAYOUT_SIMPLE;
-			break;
+			return LAYOUT_SIMPLE;
 		case EffekseerRenderer::RendererShaderType::AdvancedLit :
 		case EffekseerRenderer::RendererShaderType::AdvancedBackDistortion :
-			m_current_layout = LAYOUT_ADVLIGHTING;
-			break;
+			return LAYOUT_ADVLIGHTING;
 		case EffekseerRenderer::RendererShaderType::AdvancedUnlit :
-			m_current_layout = LAYOUT_ADVSIMPLE;
+			return LAYOUT_ADVSIMPLE;
+		default:
+			assert(false);
+			return LAYOUT_SIMPLE;
+		}
+	}
+	void SwitchLayout(const EffekseerRenderer::StandardRendererState& state) {
+		switch (state.Collector.ShaderType) {
+		case EffekseerRenderer::RendererShaderType::Lit :
+		case EffekseerRenderer::RendererShaderType::BackDistortion :
+		case EffekseerRenderer::RendererShaderType::Unlit :
+		case EffekseerRenderer::RendererShaderType::AdvancedLit :
+		case EffekseerRenderer::RendererShaderType::AdvancedBackDistortion :
+		case EffekseerRenderer::RendererShaderType::AdvancedUnlit :
+			m_current_layout = SpriteLayout(state.Collector.ShaderType);
 			break;
+		case EffekseerRenderer::RendererShaderType::Material : {
+			const auto& material = state.Collector.MaterialDataPtr;
+			assert(material != nullptr);
+			if (material->IsSimpleVertex) {
+				m_current_layout = MaterialLayout(true, 0, 0);
+			} else {
+				m_current_layout = MaterialLayout(false, material->CustomData1, material->CustomData2);
+			}
+			break;
+		}
 		default:
-			// todo:
-			m_current_layout = LAYOUT_MATERIAL;
+			assert(false);
 			return;
 		}
-		if (m_layouts[m_current_layout].cap == 0) {
-			m_layouts[m_current_layout].cap = 4 * GetSquareMaxCount();
-			AllocVertexBuffer();
-		}
 	}
+	// Returns false if the buffer is full and there are vertices not drawn, call it again after drawing them.
 	bool AppendSprites(int count, int& stride, void*& data) {
-		if (m_current_layout == LAYOUT_MATERIAL) {
-			stride = 0;
-			data = nullptr;
-			return true;	// todo
-		}
-
 		auto& layout = m_layouts[m_current_layout];
-		assert(layout.cap > 0);
-		stride = layout.tvb.stride;
-		data = layout.tvb.data + layout.count * stride;
 		if (count + layout.count > layout.cap) {
-			// full
-			AllocVertexBuffer();
-			return false;
+			if (layout.count > layout.offset)
+				return false;
+			AllocVertexBuffer(count);
+		}
+		stride = layout.layout.stride;
+		if (layout.cap == 0) {
+			m_scratch.resize(count * stride);
+			data = m_scratch.data();
+			m_stats.vertexDropped += count;
+			return true;
 		}
+		data = layout.data + layout.count * stride;
 		layout.count += count;
+		layout.total += count;
+		if (layout.ring >= 0)
+			m_rings[m_current_layout].head += count;
+		m_stats.vertexBytesUsed += count * stride;
 		return true;
 	}
 
+	// Any vertices appended since last draw
 	bool NeedDraw() {
-		return m_layouts[m_current_layout].count > 0;
+		const auto& layout = m_layouts[m_current_layout];
+		return layout.count > layout.offset;
 	}
 	void ResetDraw() {
 		auto& layout = m_layouts[m_current_layout];
@@ -1177,35 +2126,162 @@ public:
 		(void)vertexOffset;
 
 		const auto& layout = m_layouts[m_current_layout];
-		const int offset = layout.offset;
-		const int count = layout.count - offset;
+		const int count = layout.count - layout.offset;
+		if (count <= 0)
+			return;
 
-		BGFX(encoder_set_transient_vertex_buffer)(m_encoder, 0, &layout.tvb, offset, count);
+		SumbitUniforms(m_currentShader);
+		BindTextures();
+		BindSpriteVertices(count);
 		const uint32_t indexCount = count / 4 * 6;
-		BGFX(encoder_set_index_buffer)(m_encoder, m_indexBuffer->GetInterface(), 0, indexCount);
-		BGFX(encoder_submit)(m_encoder, m_viewid, m_currentShader->m_program, 0, BGFX_DISCARD_ALL);
+		BGFX(encoder_set_index_buffer)(m_encoder, GetIndexBuffer()->GetInterface(), 0, indexCount);
+		BGFX(encoder_submit)(m_encoder, m_viewid, m_currentShader->m_program, 0, SUBMIT_DISCARD);
+		++m_stats.drawCalls;
+		++m_stats.spriteDrawCalls;
+		m_stats.sprites[m_current_layout < LAYOUT_MATERIAL ? m_current_layout : STATS_LAYOUT_MATERIAL] += count / 4;
+	}
+	// Bind `count` vertices appended since last draw (layout.offset)
+	void BindSpriteVertices(int count) {
+		const auto& layout = m_layouts[m_current_layout];
+		const int offset = layout.offset;
+		if (layout.ring >= 0) {
+			const auto &ring = m_rings[m_current_layout];
+			const int stride = layout.layout.stride;
+			const uint32_t start = layout.ring + offset;
+			BGFX(update_dynamic_vertex_buffer)(ring.handle, start, BGFX(make_ref)(layout.data + offset * stride, count * stride));
+			BGFX(encoder_set_dynamic_vertex_buffer)(m_encoder, 0, ring.handle, start, count);
+		} else {
+			BGFX(encoder_set_transient_vertex_buffer)(m_encoder, 0, &layout.tvb, offset, count);
+		}
 	}
+	// Draw with explicit counts : a model without instancing (or the wire frame of it), or the vertices of the sprite buffer.
 	void DrawPolygon(int32_t vertexCount, int32_t indexCount) {
-		// todo:
+		if (!BGFX_HANDLE_IS_VALID(m_currentVertexBuffer)) {
+			auto& layout = m_layouts[m_current_layout];
+			const int count = (std::min)(vertexCount, layout.count - layout.offset);
+			if (count <= 0)
+				return;
+			// The index buffer is for quads, don't reference the vertices not bound
+			indexCount = (std::min)(indexCount, count / 4 * 6);
+			SumbitUniforms(m_currentShader);
+			BindTextures();
+			BindSpriteVertices(count);
+			BGFX(encoder_set_index_buffer)(m_encoder, GetIndexBuffer()->GetInterface(), 0, indexCount);
+			BGFX(encoder_submit)(m_encoder, m_viewid, m_currentShader->m_program, 0, SUBMIT_DISCARD);
+			++m_stats.drawCalls;
+			++m_stats.spriteDrawCalls;
+			// These vertices are drawn, the next DrawSprites starts after them
+			layout.offset += count;
+			return;
+		}
+		if (m_currentShader->m_instanced) {
+			// Batch the consecutive models with the same shader and buffers into one draw call
+			AppendInstances(1, vertexCount, indexCount);
+			return;
+		}
+		SumbitUniforms(m_currentShader);
+		BindTextures();
+		BindModelBuffers(vertexCount, indexCount);
+		BGFX(encoder_submit)(m_encoder, m_viewid, m_currentShader->m_program, 0, SUBMIT_DISCARD);
+		++m_stats.drawCalls;
+		++m_stats.modelDrawCalls;
 	}
 	void DrawPolygonInstanced(int32_t vertexCount, int32_t indexCount, int32_t instanceCount) {
+		if (m_currentShader->m_instanced) {
+			AppendInstances(instanceCount, vertexCount, indexCount);
+			return;
+		}
+		SumbitUniforms(m_currentShader);
+		BindTextures();
+		BindModelBuffers(vertexCount, indexCount);
 		BGFX(encoder_set_instance_count)(m_encoder, instanceCount);
-		BGFX(encoder_submit)(m_encoder, m_viewid, m_currentShader->m_program, 0, BGFX_DISCARD_ALL);
+		BGFX(encoder_submit)(m_encoder, m_viewid, m_currentShader->m_program, 0, SUBMIT_DISCARD);
+		++m_stats.drawCalls;
+		++m_stats.modelDrawCalls;
 	}
-	Shader* GetShader(EffekseerRenderer::RendererShaderType type) const {
+	Shader* GetShader(EffekseerRenderer::RendererShaderType type) {
 		int n = (int)type;
 		if (n<0 || n>= SHADERCOUNT)
 			return nullptr;
-		return m_shaders[n];
+		return GetBuiltinShader(n, false);
+	}
+	// All the built-in model shaders are created by the root, so no need to select one before EndRendering_
+	bool IsModelShadersReady() const {
+		const uint32_t mask = ((1u << SHADERCOUNT) - 1) << SHADERCOUNT;
+		return (Root()->m_builtinReady.load(std::memory_order_acquire) & mask) == mask;
+	}
+	Shader* GetModelShader(EffekseerRenderer::RendererShaderType type) {
+		int n = (int)type;
+		if (n<0 || n>= SHADERCOUNT)
+			return nullptr;
+		return GetBuiltinShader(n, true);
 	}
 	void BeginShader(Shader* shader) {
 		assert(m_currentShader == nullptr);
-		m_currentShader = shader;
+		m_currentShader = LocalShader(shader);
 	}
 	void EndShader(Shader* shader) {
-		assert(m_currentShader == shader);
+		assert(m_currentShader == shader || m_currentShader->m_sourceSerial == shader->m_serial);
+		DrawInstances();
 		m_currentShader = nullptr;
 	}
+	// ModelRendererBase splits the models into groups of MaxInstanced, and calls DrawPolygonInstanced for each group
+	// with the same states. Collect them, and draw all of them in one draw call (at EndShader, or when the buffers change).
+	void AppendInstances(int32_t instanceCount, int32_t vertexCount, int32_t indexCount) {
+		if (m_instanceCount > 0 && ((uint32_t)vertexCount != m_instanceVertices || (uint32_t)indexCount != m_instanceIndices))
+			DrawInstances();
+		m_instanceVertices = vertexCount;
+		m_instanceIndices = indexCount;
+		const Shader *shader = m_currentShader;
+		const uint8_t *vcb = (const uint8_t *)shader->m_vcbBuffer;
+		const Effekseer::Matrix44 *matrix = (const Effekseer::Matrix44 *)(vcb + shader->m_modelMatrixOffset);
+		const float (*uv)[4] = (const float (*)[4])(vcb + shader->m_modelUVOffset);
+		const float (*color)[4] = (const float (*)[4])(vcb + shader->m_modelColorOffset);
+		const size_t n = m_instanceCount * MODEL_INSTANCE_STRIDE / sizeof(float);
+		m_instanceData.resize(n + instanceCount * MODEL_INSTANCE_STRIDE / sizeof(float));
+		float *dst = m_instanceData.data() + n;
+		int32_t i, j;
+		for (i=0;i<instanceCount;i++) {
+			const auto &m = matrix[i].Values;
+			for (j=0;j<3;j++) {
+				dst[0] = m[0][j];
+				dst[1] = m[1][j];
+				dst[2] = m[2][j];
+				dst[3] = m[3][j];
+				dst += 4;
+			}
+			memcpy(dst, uv[i], 4 * sizeof(float));
+			memcpy(dst + 4, color[i], 4 * sizeof(float));
+			dst += 8;
+		}
+		m_instanceCount += instanceCount;
+	}
+	void DrawInstances() {
+		if (m_instanceCount == 0)
+			return;
+		Shader *base = m_currentShader;
+		Shader *s = base->m_instanced;
+		uint32_t num = BGFX(get_avail_instance_data_buffer)(m_instanceCount, (uint16_t)MODEL_INSTANCE_STRIDE);
+		if (num < (uint32_t)m_instanceCount) {
+			m_stats.instanceDropped += m_instanceCount - num;
+		}
+		m_instanceCount = 0;
+		if (num == 0)
+			return;
+		bgfx_instance_data_buffer_t idb;
+		BGFX(alloc_instance_data_buffer)(&idb, num, (uint16_t)MODEL_INSTANCE_STRIDE);
+		memcpy(idb.data, m_instanceData.data(), num * MODEL_INSTANCE_STRIDE);
+
+		memcpy(s->m_vcbBuffer, base->m_vcbBuffer, base->m_vcbSize);
+		memcpy(s->m_pcbBuffer, base->m_pcbBuffer, base->m_pcbSize);
+		SumbitUniforms(s);
+		BindTextures();
+		BindModelBuffers(m_instanceVertices, m_instanceIndices);
+		BGFX(encoder_set_instance_data_buffer)(m_encoder, &idb, 0, num);
+		BGFX(encoder_submit)(m_encoder, m_viewid, s->m_program, 0, SUBMIT_DISCARD);
+		++m_stats.drawCalls;
+		++m_stats.modelDrawCalls;
+	}
 	void SetVertexBufferToShader(const void* data, int32_t size, int32_t dstOffset) {
 		assert(m_currentShader != nullptr);
 		auto p = static_cast<uint8_t*>(m_currentShader->GetVertexConstantBuffer()) + dstOffset;
@@ -1217,8 +2293,11 @@ public:
 		memcpy(p, data, size);
 	}
 	void SetTextures(Shader* shader, Effekseer::Backend::TextureRef* textures, int32_t count) {
+		TextureBinding bindings[Shader::maxSamplers] = {};
+		count = (std::min)(count, (int32_t)Shader::maxSamplers);
 		for (int32_t ii=0; ii<count; ++ii){
 			auto sampler = shader->m_samplers[ii];
+			bindings[ii].sampler = sampler;
 			if (BGFX_HANDLE_IS_VALID(sampler)){
 				auto tex = textures[ii].DownCast<EffekseerRendererBGFX::Texture>();
 				const auto &state = m_renderState->GetActiveState();
@@ -1229,23 +2308,106 @@ public:
 				if (state.TextureWrapTypes[ii] == Effekseer::TextureWrapType::Clamp){
 					flags |= BGFX_SAMPLER_U_CLAMP|BGFX_SAMPLER_V_CLAMP;
 				}
-				int tex_id = tex->GetId();
+				uint32_t generation;
+				const int tex_id = tex->GetId(&generation);
 				bgfx_texture_handle_t handle;
-				if (tex_id < 0) {
+				if (tex_id < 0 && tex->IsEvicted()) {
+					// Don't call texture_load during Draw, it's loaded again in NextFrame
+					tex->Touch(Root()->m_frame.load(std::memory_order_relaxed));
+					RequestReload(tex.Get());
+					handle = GetImpl()->GetProxyTexture(EffekseerRenderer::ProxyTextureType::White).DownCast<Texture>()->GetInterface();
+				} else if (tex_id < 0) {
 					handle = tex->GetInterface();
 				} else {
-					handle = m_initArgs.texture_handle(tex_id, m_initArgs.ud);
+					tex->Touch(Root()->m_frame.load(std::memory_order_relaxed));
+					handle = TextureHandle(tex_id, generation);
+					if (!BGFX_HANDLE_IS_VALID(handle)) {
+						// Not loaded yet
+						handle = GetImpl()->GetProxyTexture(EffekseerRenderer::ProxyTextureType::White).DownCast<Texture>()->GetInterface();
+					}
 				}
-				BGFX(encoder_set_texture)(m_encoder, ii, sampler, handle, flags);
+				bindings[ii].handle = handle;
+				bindings[ii].flags = flags;
+			}
+		}
+		if (m_instanceCount > 0 && (count != m_textureBindingCount
+			|| memcmp(bindings, m_textureBindings, count * sizeof(TextureBinding)) != 0)) {
+			// The instances appended before use the previous textures
+			DrawInstances();
+		}
+		memcpy(m_textureBindings, bindings, count * sizeof(TextureBinding));
+		m_textureBindingCount = count;
+	}
+	// Translate texture id to handle, by the table filled by SetTextureHandle, or texture_handle callback if it's not in the table.
+	bgfx_texture_handle_t TextureHandle(int id, uint32_t generation) const {
+		const auto &slots = Root()->m_textureSlots;
+		if ((size_t)id < slots.size()) {
+			const uint32_t binding = slots[id].binding.load(std::memory_order_acquire);
+			if ((binding >> 16) != (generation & 0xffff)) {
+				// the id is unloaded, and maybe reused by another texture
+				bgfx_texture_handle_t invalid = BGFX_INVALID_HANDLE;
+				return invalid;
 			}
+			const bgfx_texture_handle_t handle = { uint16_t(binding & 0xffff) };
+			if (BGFX_HANDLE_IS_VALID(handle))
+				return handle;
+		}
+		if (m_initArgs.texture_handle == nullptr) {
+			bgfx_texture_handle_t invalid = BGFX_INVALID_HANDLE;
+			return invalid;
+		}
+		return m_initArgs.texture_handle(id, m_initArgs.ud);
+	}
+	// The handle of the id is in the table already
+	bool HasTextureHandle(int id, uint32_t generation) const {
+		const auto &slots = Root()->m_textureSlots;
+		if ((size_t)id >= slots.size())
+			return false;
+		const uint32_t binding = slots[id].binding.load(std::memory_order_acquire);
+		return (binding >> 16) == (generation & 0xffff) && (binding & 0xffff) != UINT16_MAX;
+	}
+	TextureSlot * GetTextureSlot(int id) {
+		auto &slots = Root()->m_textureSlots;
+		if ((size_t)id >= slots.size())
+			return nullptr;
+		return &slots[id];
+	}
+	void SetTextureHandle(int id, bgfx_texture_handle_t handle, int size) {
+		TextureSlot *slot = GetTextureSlot(id);
+		if (slot) {
+			uint32_t binding = slot->binding.load(std::memory_order_relaxed);
+			while (!slot->binding.compare_exchange_weak(binding, (binding & 0xffff0000) | handle.idx, std::memory_order_release, std::memory_order_relaxed)) {}
+			slot->size = size;
+		}
+	}
+	// 16 bits, it wraps around
+	uint32_t GetTextureGeneration(int id) const {
+		const auto &slots = Root()->m_textureSlots;
+		return (size_t)id < slots.size() ? slots[id].binding.load(std::memory_order_acquire) >> 16 : 0;
+	}
+	// Called before texture_unload, the handle in the table is removed, and the textures loaded before can't use the id any more.
+	void ReleaseTextureId(int id) {
+		TextureSlot *slot = GetTextureSlot(id);
+		if (slot) {
+			const uint32_t binding = slot->binding.load(std::memory_order_relaxed);
+			slot->binding.store(((binding + 0x10000) & 0xffff0000) | UINT16_MAX, std::memory_order_release);
+			slot->size = 0;
 		}
 	}
 	void ResetRenderState() override {
 		m_renderState->GetActiveState().Reset();
 		m_renderState->Update(true);
 	}
+	// The render state is kept after submit (BGFX_DISCARD_STATE is not set), so set it only when it changes.
 	void SetCurrentState(uint64_t state) {
+		if (m_stateValid && state == m_currentState) {
+			++m_stats.stateSkips;
+			return;
+		}
 		BGFX(encoder_set_state)(m_encoder, state, 0);
+		m_currentState = state;
+		m_stateValid = true;
+		++m_stats.stateChanges;
 	}
 	Effekseer::Backend::GraphicsDeviceRef GetGraphicsDevice() const override {
 		return m_device;
@@ -1261,6 +2423,241 @@ public:
 		return new Shader(this);
 	}
 	// Shader API
+	// The clone shares the program and the uniforms of the source, but has its own constant buffers.
+	Shader * CloneShader(const Shader *source) const {
+		Shader *s = new Shader(this);
+		if (!source->isValid()) {
+			s->m_render = nullptr;
+			return s;
+		}
+		s->m_shared = true;
+		s->m_sourceSerial = source->m_serial;
+		s->m_program = source->m_program;
+		s->SetVertexConstantBufferSize(source->m_vcbSize);
+		s->SetPixelConstantBufferSize(source->m_pcbSize);
+		s->m_vsSize = source->m_vsSize;
+		s->m_fsSize = source->m_fsSize;
+		int i;
+		for (i=0;i<s->m_vsSize + s->m_fsSize;i++) {
+			auto &u = s->m_uniform[i];
+			u = source->m_uniform[i];
+			const uint8_t *ptr = (const uint8_t *)u.ptr;
+			if (ptr == nullptr)
+				continue;
+			if (ptr >= source->m_vcbBuffer && ptr < source->m_vcbBuffer + source->m_vcbSize) {
+				u.ptr = s->m_vcbBuffer + (ptr - source->m_vcbBuffer);
+			} else {
+				assert(ptr >= source->m_pcbBuffer && ptr < source->m_pcbBuffer + source->m_pcbSize);
+				u.ptr = s->m_pcbBuffer + (ptr - source->m_pcbBuffer);
+			}
+		}
+		memcpy(s->m_samplers, source->m_samplers, sizeof(s->m_samplers));
+		s->m_modelMatrixOffset = source->m_modelMatrixOffset;
+		s->m_modelUVOffset = source->m_modelUVOffset;
+		s->m_modelColorOffset = source->m_modelColorOffset;
+		if (source->m_instanced)
+			s->m_instanced = CloneShader(source->m_instanced);
+		return s;
+	}
+	// Shaders created by another renderer (ie. materials loaded by the root renderer) are used by a clone,
+	// so the constant buffers are never shared between threads.
+	Shader * LocalShader(Shader *shader) {
+		if (shader->m_render == this)
+			return shader;
+		auto it = m_clones.find(shader);
+		if (it != m_clones.end()) {
+			if (it->second->m_sourceSerial == shader->m_serial)
+				return it->second;
+			// The source has been released, and the address is reused.
+			delete it->second;
+			m_clones.erase(it);
+		}
+		Shader *clone = CloneShader(shader);
+		m_clones[shader] = clone;
+		return clone;
+	}
+	// Material shader cache, only the root renderer owns it.
+	Shader * AcquireMaterialShader(uint64_t guid, int kind) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		auto &cache = m_materialShaders[kind];
+		auto it = cache.find(guid);
+		if (it == cache.end())
+			return nullptr;
+		++it->second->m_ref;
+		return it->second;
+	}
+	Shader * AddMaterialShader(uint64_t guid, int kind, Shader *shader) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		auto &cache = m_materialShaders[kind];
+		auto it = cache.find(guid);
+		if (it != cache.end()) {
+			// Loaded by another thread at the same time
+			delete shader;
+			++it->second->m_ref;
+			return it->second;
+		}
+		shader->m_guid = guid;
+		shader->m_kind = kind;
+		shader->m_ref = 1;
+		cache[guid] = shader;
+		return shader;
+	}
+	Effekseer::TextureRef AcquireTexture(const std::string &key) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> guard(root->m_lock);
+		auto it = root->m_textures.find(key);
+		if (it == root->m_textures.end()) {
+			++root->m_textureCacheStats.misses;
+			return nullptr;
+		}
+		++root->m_textureCacheStats.hits;
+		++it->second.ref;
+		return it->second.texture;
+	}
+	Effekseer::TextureRef AddTexture(const std::string &key, const char *path, int srgb, const Effekseer::TextureRef &texture) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> guard(root->m_lock);
+		auto it = root->m_textures.find(key);
+		if (it != root->m_textures.end()) {
+			++it->second.ref;
+			return it->second.texture;
+		}
+		root->m_textures[key] = CachedTexture { texture, 1, path, srgb };
+		root->m_textureKeys[texture.Get()] = key;
+		root->m_backendKeys[texture->GetBackend().DownCast<Texture>().Get()] = key;
+		return texture;
+	}
+	// Returns true if it's the last reference, and the texture should be unloaded.
+	bool ReleaseCachedTexture(const Effekseer::TextureRef &texture) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> guard(root->m_lock);
+		auto k = root->m_textureKeys.find(texture.Get());
+		if (k == root->m_textureKeys.end())
+			return true;
+		auto it = root->m_textures.find(k->second);
+		assert(it != root->m_textures.end() && it->second.ref > 0);
+		if (--it->second.ref > 0)
+			return false;
+		root->m_backendKeys.erase(texture->GetBackend().DownCast<Texture>().Get());
+		root->m_textures.erase(it);
+		root->m_textureKeys.erase(k);
+		// The evicted texture is unloaded already
+		return !texture->GetBackend().DownCast<Texture>()->IsEvicted();
+	}
+	void SetTextureBudget(int bytes) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> guard(root->m_lock);
+		root->m_textureBudget = bytes;
+	}
+	// Unload the textures not used in last frame (least recently used first), until the resident size is in the budget.
+	// It's called by NextFrame, so no texture is in use.
+	void EvictTextures() {
+		std::lock_guard<std::mutex> guard(m_lock);
+		const uint32_t frame = m_frame.load();
+		std::vector<std::pair<uint32_t, Texture *>> cold;
+		int total = 0;
+		for (auto &it : m_textures) {
+			Texture *tex = it.second.texture->GetBackend().DownCast<Texture>().Get();
+			const int id = tex->GetId();
+			if (id < 0 || id >= MAX_TEXTURE_ID)
+				continue;
+			const int size = m_textureSlots[id].size;
+			total += size;
+			if (size > 0 && frame - tex->GetLastUsed() > 1)
+				cold.emplace_back(tex->GetLastUsed(), tex);
+		}
+		if (m_textureBudget > 0 && total > m_textureBudget) {
+			std::sort(cold.begin(), cold.end(), [](const std::pair<uint32_t, Texture *> &a, const std::pair<uint32_t, Texture *> &b) {
+				return a.first < b.first;
+			});
+			for (auto &c : cold) {
+				if (total <= m_textureBudget)
+					break;
+				Texture *tex = c.second;
+				const int id = tex->GetId();
+				total -= m_textureSlots[id].size;
+				tex->Evict();
+				ReleaseTextureId(id);
+				m_initArgs.texture_unload(id, m_initArgs.ud);
+				++m_textureCacheStats.evictions;
+			}
+		}
+		m_textureCacheStats.residentBytes = total;
+	}
+	// The evicted texture is used in Draw (maybe by a worker renderer), queue it for NextFrame.
+	void RequestReload(const Texture *tex) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> guard(root->m_lock);
+		auto k = root->m_backendKeys.find(tex);
+		if (k == root->m_backendKeys.end())
+			return;
+		if (std::find(root->m_reloads.begin(), root->m_reloads.end(), k->second) == root->m_reloads.end())
+			root->m_reloads.push_back(k->second);
+	}
+	// Load the queued textures again, it's called by NextFrame.
+	void ReloadTextures() {
+		std::vector<std::string> reloads;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			reloads.swap(m_reloads);
+		}
+		for (auto &key : reloads) {
+			Effekseer::TextureRef texture;
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				auto it = m_textures.find(key);
+				if (it == m_textures.end())
+					continue;	// released
+				texture = it->second.texture;
+			}
+			uint32_t generation;
+			ReloadTexture(texture->GetBackend().DownCast<Texture>().Get(), &generation);
+		}
+	}
+	// Load the evicted texture again, returns the new id (or -1).
+	// texture_load is called in the thread which calls NextFrame (or Prewarm), never during Draw. See SetTextureBudget
+	int ReloadTexture(Texture *tex, uint32_t *generation) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> guard(root->m_lock);
+		if (!tex->IsEvicted())
+			return tex->GetId(generation);	// reloaded already
+		auto k = root->m_backendKeys.find(tex);
+		if (k == root->m_backendKeys.end())
+			return -1;
+		auto it = root->m_textures.find(k->second);
+		assert(it != root->m_textures.end());
+		int id = m_initArgs.texture_load(it->second.path.c_str(), it->second.srgb, m_initArgs.ud);
+		if (id < 0)
+			return -1;
+		*generation = GetTextureGeneration(id);
+		tex->Reload(id, *generation);
+		++root->m_textureCacheStats.reloads;
+		return id;
+	}
+	void GetTextureCacheStats(TextureCacheStats *stats) const {
+		const RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> guard(root->m_lock);
+		*stats = root->m_textureCacheStats;
+		stats->textures = (int)root->m_textures.size();
+	}
+	void ReleaseMaterialShader(Shader *shader) {
+		if (shader == nullptr)
+			return;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			assert(shader->m_kind >= 0 && shader->m_ref > 0);
+			if (--shader->m_ref > 0)
+				return;
+			m_materialShaders[shader->m_kind].erase(shader->m_guid);
+		}
+		delete shader;
+	}
+	void ClearClones() {
+		for (auto &it : m_clones) {
+			delete it.second;
+		}
+		m_clones.clear();
+	}
 	bool InitShader(Shader *s, bgfx_shader_handle_t vs, bgfx_shader_handle_t fs) const {
 		if (!(BGFX_HANDLE_IS_VALID(vs) && BGFX_HANDLE_IS_VALID(fs))){
 			s->m_render = nullptr;
@@ -1277,78 +2674,122 @@ public:
 		for (i=0;i<s->m_vsSize;i++) {
 			s->m_uniform[i].handle = u[i];
 			s->m_uniform[i].count = 0;
+			s->m_uniform[i].size = 0;
 			s->m_uniform[i].ptr = nullptr;
 		}
 		s->m_fsSize = BGFX(get_shader_uniforms)(fs, u, Shader::maxUniform - s->m_vsSize);
 		for (i=0;i<s->m_fsSize;i++) {
 			s->m_uniform[i+s->m_vsSize].handle = u[i];
 			s->m_uniform[i+s->m_vsSize].count = 0;
+			s->m_uniform[i+s->m_vsSize].size = 0;
 			s->m_uniform[i+s->m_vsSize].ptr = nullptr;
 		}
 		for (i=0;i<Shader::maxSamplers;i++) {
 			s->m_samplers[i].idx = UINT16_MAX;
 		}
+		bgfx_uniform_info_t info;
+		for (i=0;i<s->m_vsSize + s->m_fsSize;i++) {
+			info.name[0] = 0;
+			BGFX(get_uniform_info)(s->m_uniform[i].handle, &info);
+			auto &slot = s->m_uniformIndex[info.name];
+			if (i < s->m_vsSize)
+				slot.vs = i;
+			else
+				slot.fs = i;
+			slot.num = info.num;
+			slot.type = info.type;
+		}
 		return true;
 	}
 	void ReleaseShader(Shader *s) const {
 		if (s->isValid()) {
-			BGFX(destroy_program)(s->m_program);
+			if (!s->m_shared)
+				BGFX(destroy_program)(s->m_program);
 			s->m_render = nullptr;
 		}
 	}
-	void SumbitUniforms(Shader *s) const {
+	static int UniformSize(bgfx_uniform_type_t type) {
+		switch (type) {
+		case BGFX_UNIFORM_TYPE_VEC4:
+			return 4 * sizeof(float);
+		case BGFX_UNIFORM_TYPE_MAT3:
+			return 3 * 3 * sizeof(float);
+		case BGFX_UNIFORM_TYPE_MAT4:
+			return 4 * 4 * sizeof(float);
+		default:
+			return 0;
+		}
+	}
+	// Uniform values persist between draw calls in a sequential view, so we can skip the unchanged ones.
+	bool UniformChanged(const bgfx_uniform_handle_t handle, const void *ptr, int size) {
+		if ((size_t)handle.idx >= m_uniformValues.size())
+			m_uniformValues.resize(handle.idx + 1);
+		auto &v = m_uniformValues[handle.idx];
+		if (v.valid && (int)v.data.size() == size && memcmp(v.data.data(), ptr, size) == 0)
+			return false;
+		v.valid = true;
+		v.data.assign((const uint8_t *)ptr, (const uint8_t *)ptr + size);
+		return true;
+	}
+	void InvalidateUniforms() {
+		for (auto &v : m_uniformValues) {
+			v.valid = false;
+		}
+	}
+	void SumbitUniforms(Shader *s) {
 		if (!s->isValid())
 			return;
 		int i;
 		for (i=0;i<s->m_vsSize + s->m_fsSize;i++) {
-			if (s->m_uniform[i].ptr != nullptr) {
-				BGFX(encoder_set_uniform)(m_encoder, s->m_uniform[i].handle, s->m_uniform[i].ptr, s->m_uniform[i].count);
+			const auto &u = s->m_uniform[i];
+			if (u.ptr != nullptr) {
+				if (m_uniformCache && !UniformChanged(u.handle, u.ptr, u.size)) {
+					++m_stats.uniformSkips;
+					continue;
+				}
+				BGFX(encoder_set_uniform)(m_encoder, u.handle, u.ptr, u.count);
+				++m_stats.uniformSubmits;
+				m_stats.uniformBytes += u.size;
 			}
 		}
 	}
 	int AddUniform(Shader *s, const char *name, Shader::UniformType type, int offset) const {
 		if (!s->isValid())
 			return -1;
-		int i;
-		int from = 0;
-		int	to = s->m_vsSize + s->m_fsSize;
+		auto it = s->m_uniformIndex.find(name);
+		if (it == s->m_uniformIndex.end())
+			return -1;
+		const auto &slot = it->second;
+		int i = -1;
 		switch(type) {
 		case Shader::UniformType::Vertex:
-			to = s->m_vsSize;
+			i = slot.vs;
 			break;
 		case Shader::UniformType::Pixel:
-			from = s->m_vsSize;
-			to = s->m_vsSize + s->m_fsSize;
+			i = slot.fs;
 			break;
 		default:
+			i = (slot.vs >= 0 && s->m_uniform[slot.vs].count == 0) ? slot.vs : slot.fs;
 			break;
 		}
-		bgfx_uniform_info_t info;
-		for (i=from;i<to;i++) {
-			if (s->m_uniform[i].count == 0) {
-				info.name[0] = 0;
-				BGFX(get_uniform_info)(s->m_uniform[i].handle, &info);
-				if (strcmp(info.name, name) == 0) {
-					break;
-				}
-			}
-		}
 
-		if (i >= to) {
+		if (i < 0 || s->m_uniform[i].count != 0) {
 			return -1;
 		}
 
 		switch(type) {
 		case Shader::UniformType::Vertex:
 			s->m_uniform[i].ptr = s->m_vcbBuffer + offset;
-			s->m_uniform[i].count = info.num;
+			s->m_uniform[i].count = slot.num;
+			s->m_uniform[i].size = slot.num * UniformSize(slot.type);
 			break;
 		case Shader::UniformType::Pixel:
 			s->m_uniform[i].ptr = s->m_pcbBuffer + offset;
-			s->m_uniform[i].count = info.num;
+			s->m_uniform[i].count = slot.num;
+			s->m_uniform[i].size = slot.num * UniformSize(slot.type);
 			break;
 		case Shader::UniformType::Texture:
-			assert(info.type == BGFX_UNIFORM_TYPE_SAMPLER);
+			assert(slot.type == BGFX_UNIFORM_TYPE_SAMPLER);
 			assert(0 <= offset && offset < Shader::maxSamplers);
 			s->m_uniform[i].count = offset + 1;
 			assert(!BGFX_HANDLE_IS_VALID(s->m_samplers[offset]));
@@ -1375,15 +2816,69 @@ public:
 		if (BGFX_HANDLE_IS_VALID(h))
 			BGFX(destroy_texture)(h);
 	}
+	// Reference the buffer of the model in UploadModel, or copy it.
+	const bgfx_memory_t * ModelMemory(const void *data, uint32_t size) const {
+		ModelUpload *upload = Root()->m_upload;
+		if (upload == nullptr)
+			return BGFX(copy)(data, size);
+		upload->pending.fetch_add(1, std::memory_order_relaxed);
+		return BGFX(make_ref_release)(data, size, ModelUpload::Release, upload);
+	}
+	// Create the buffers of a new model without copying the vertices and indices.
+	// Model::StoreBufferToGPU passes its own arrays (when flipVertexColor is false), so the model is kept until bgfx releases them.
+	void UploadModel(const Effekseer::ModelRef &model) {
+		RendererImplemented *root = Root();
+		// models are shared by the worker renderers
+		std::lock_guard<std::mutex> lock(root->m_lock);
+		if (model->GetIsBufferStoredOnGPU())
+			return;	// by another thread
+		ModelUpload *upload = new ModelUpload;
+		upload->model = model;
+		upload->pending = 1;
+		root->CollectUploadsLocked();
+		root->m_upload = upload;
+		model->StoreBufferToGPU(m_device.Get());
+		root->m_upload = nullptr;
+		if (upload->pending.load(std::memory_order_acquire) == 1) {
+			delete upload;
+		} else {
+			root->m_uploads.push_back(upload);
+		}
+	}
+	// Delete the uploads released by bgfx, only the renderer references them.
+	void CollectUploadsLocked() {
+		auto iter = std::remove_if(m_uploads.begin(), m_uploads.end(), [](ModelUpload *upload) {
+			if (upload->pending.load(std::memory_order_acquire) != 1)
+				return false;
+			delete upload;
+			return true;
+		});
+		m_uploads.erase(iter, m_uploads.end());
+	}
+	void CollectUploads() {
+		std::lock_guard<std::mutex> lock(m_lock);
+		CollectUploadsLocked();
+	}
+	static void DetachModel(const Effekseer::ModelRef &model) {
+		for (int32_t f = 0; f < model->GetFrameCount(); f++) {
+			auto vb = model->GetVertexBuffer(f).DownCast<StaticVertexBuffer>();
+			if (vb != nullptr)
+				vb->Detach();
+			for (auto ib : { model->GetIndexBuffer(f).DownCast<StaticIndexBuffer>(), model->GetWireIndexBuffer(f).DownCast<StaticIndexBuffer>() }) {
+				if (ib != nullptr)
+					ib->Detach();
+			}
+		}
+	}
 	Effekseer::Backend::IndexBufferRef CreateIndexBuffer(int32_t elementCount, const void* initialData, Effekseer::Backend::IndexBufferStrideType stride) const {
 		int s = (stride == Effekseer::Backend::IndexBufferStrideType::Stride4) ? 4 : 2;
-		const bgfx_memory_t *mem = BGFX(copy)(initialData, elementCount * s);
+		const bgfx_memory_t *mem = ModelMemory(initialData, elementCount * s);
 		bgfx_index_buffer_handle_t handle = BGFX(create_index_buffer)(mem, s == 4 ? BGFX_BUFFER_INDEX32 : BGFX_BUFFER_NONE);
 
 		return Effekseer::MakeRefPtr<StaticIndexBuffer>(this, handle, s, elementCount);
 	}
 	Effekseer::Backend::VertexBufferRef CreateVertexBuffer(int32_t size, const void* initialData) const {
-		const bgfx_memory_t *mem = BGFX(copy)(initialData, size);
+		const bgfx_memory_t *mem = ModelMemory(initialData, size);
 		bgfx_vertex_buffer_handle_t handle = BGFX(create_vertex_buffer)(mem, &m_modellayout, BGFX_BUFFER_NONE);
 		return  Effekseer::MakeRefPtr<StaticVertexBuffer>(this, handle);
 	}
@@ -1393,97 +2888,110 @@ public:
 	void ReleaseVertexBuffer(StaticVertexBuffer *vb) const {
 		BGFX(destroy_vertex_buffer)(vb->GetInterface());
 	}
-	bool StoreModelToGPU(Effekseer::ModelRef model) const {
+	bool StoreModelToGPU(Effekseer::ModelRef model) {
 		if (model == nullptr)
 			return false;
-		model->StoreBufferToGPU(m_device.Get());
 		if (!model->GetIsBufferStoredOnGPU())
-			return false;
-		return true;
+			UploadModel(model);
+		return model->GetIsBufferStoredOnGPU();
+	}
+	// Layout of the sprite vertices of user defined materials.
+	// Simple : EffekseerRenderer::SimpleVertex
+	// Complex : EffekseerRenderer::DynamicVertex + CustomData1 + CustomData2
+	static int MaterialLayout(bool simple, int cd1, int cd2) {
+		if (simple)
+			return LAYOUT_MATERIAL;
+		assert(0 <= cd1 && cd1 < LAYOUT_MATERIAL_CUSTOMDATA);
+		assert(0 <= cd2 && cd2 < LAYOUT_MATERIAL_CUSTOMDATA);
+		return LAYOUT_MATERIAL + 1 + cd1 * LAYOUT_MATERIAL_CUSTOMDATA + cd2;
+	}
+	void GenMaterialLayout(bgfx_vertex_layout_t *layout, bool simple, int cd1, int cd2) const {
+		BGFX(vertex_layout_begin)(layout, BGFX_RENDERER_TYPE_NOOP);
+		if (simple) {
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_POSITION, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_COLOR0, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_TEXCOORD0, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
+		} else {
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_POSITION, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_COLOR0, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_NORMAL, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_TANGENT, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_TEXCOORD0, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
+			BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_TEXCOORD1, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
+			if (cd1 > 0)
+				BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_TEXCOORD2, cd1, BGFX_ATTRIB_TYPE_FLOAT, false, false);
+			if (cd2 > 0)
+				BGFX(vertex_layout_add)(layout, BGFX_ATTRIB_TEXCOORD3, cd2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
+		}
+		BGFX(vertex_layout_end)(layout);
 	}
-	bgfx_vertex_layout_handle_t CreateMaterialSimple() const {
-		bgfx_vertex_layout_t layout;
-		BGFX(vertex_layout_begin)(&layout, BGFX_RENDERER_TYPE_NOOP);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_POSITION, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_COLOR0, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD0, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-		BGFX(vertex_layout_end)(&layout);
-		return BGFX(create_vertex_layout)(&layout);
-	}
-	bgfx_vertex_layout_handle_t CreateMaterialComplex(int cd1, int cd2) const {
-		bgfx_vertex_layout_t layout;
-		BGFX(vertex_layout_begin)(&layout, BGFX_RENDERER_TYPE_NOOP);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_POSITION, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_COLOR0, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_NORMAL, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TANGENT, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD0, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD1, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD2, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD3, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD4, cd1, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD4, cd2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-		BGFX(vertex_layout_end)(&layout);
-		return BGFX(create_vertex_layout)(&layout);
-	}
-	bgfx_vertex_layout_handle_t CreateMaterialModel() const {
-		bgfx_vertex_layout_t layout;
-		BGFX(vertex_layout_begin)(&layout, BGFX_RENDERER_TYPE_NOOP);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_POSITION, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_NORMAL, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_BITANGENT, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TANGENT, 3, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_TEXCOORD0, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
-			BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_COLOR0, 4, BGFX_ATTRIB_TYPE_UINT8, true, false);
-		BGFX(vertex_layout_end)(&layout);
-		return BGFX(create_vertex_layout)(&layout);
+	// The layout handles are created on demand, and shared by the worker renderers.
+	bgfx_vertex_layout_handle_t GetLayoutHandle(int id) {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> lock(root->m_lock);
+		bgfx_vertex_layout_handle_t &handle = root->m_layouts[id].handle;
+		if (!BGFX_HANDLE_IS_VALID(handle))
+			handle = BGFX(create_vertex_layout)(&root->m_layouts[id].layout);
+		return handle;
+	}
+	bgfx_vertex_layout_handle_t GetModelLayoutHandle() {
+		RendererImplemented *root = Root();
+		std::lock_guard<std::mutex> lock(root->m_lock);
+		if (!BGFX_HANDLE_IS_VALID(root->m_modellayoutHandle))
+			root->m_modellayoutHandle = BGFX(create_vertex_layout)(&root->m_modellayout);
+		return root->m_modellayoutHandle;
 	}
 };
 
-void RenderState::Update(bool forced) {
-	(void)forced;	// ignore forced
-	uint64_t state = 0
-		| BGFX_STATE_WRITE_RGB
-		| BGFX_STATE_WRITE_A
-		| BGFX_STATE_FRONT_CCW
-		| BGFX_STATE_MSAA;
-
-	if (m_next.DepthTest) {
-		state |= m_invz ? BGFX_STATE_DEPTH_TEST_GEQUAL : BGFX_STATE_DEPTH_TEST_LEQUAL;
+static constexpr uint64_t s_stateBase = 0
+	| BGFX_STATE_WRITE_RGB
+	| BGFX_STATE_WRITE_A
+	| BGFX_STATE_FRONT_CCW
+	| BGFX_STATE_MSAA;
+
+// isCCW : Front, Back, Double
+static constexpr uint64_t s_stateCulling[STATE_CULLING_COUNT] = {
+	BGFX_STATE_CULL_CW,
+	BGFX_STATE_CULL_CCW,
+	0,
+};
+
+// Opacity, Blend, Add, Sub, Mul
+static constexpr uint64_t s_stateBlend[STATE_BLEND_COUNT] = {
+	BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_ADD, BGFX_STATE_BLEND_EQUATION_MAX)
+		| BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE),
+	BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_ADD, BGFX_STATE_BLEND_EQUATION_ADD)
+		| BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE),
+	BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_ADD, BGFX_STATE_BLEND_EQUATION_ADD)
+		| BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE),
+	BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_REVSUB, BGFX_STATE_BLEND_EQUATION_ADD)
+		| BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_ONE),
+	BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_ADD, BGFX_STATE_BLEND_EQUATION_ADD)
+		| BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_SRC_COLOR, BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_ONE),
+};
+
+uint64_t RenderState::MakeState(bool depthTest, bool depthWrite, int culling, int blend, bool invz) {
+	uint64_t state = s_stateBase | s_stateCulling[culling] | s_stateBlend[blend];
+	if (depthTest) {
+		state |= invz ? BGFX_STATE_DEPTH_TEST_GEQUAL : BGFX_STATE_DEPTH_TEST_LEQUAL;
 	} else {
 		state |= BGFX_STATE_DEPTH_TEST_ALWAYS;
 	}
-
-	if (m_next.DepthWrite) {
+	if (depthWrite) {
 		state |= BGFX_STATE_WRITE_Z;
 	}
+	return state;
+}
 
-	// isCCW
-	if (m_next.CullingType == Effekseer::CullingType::Front) {
-		state |= BGFX_STATE_CULL_CW;
-	}
-	else if (m_next.CullingType == Effekseer::CullingType::Back) {
-		state |= BGFX_STATE_CULL_CCW;
-	}
-	if (m_next.AlphaBlend == ::Effekseer::AlphaBlendType::Opacity ||
-		m_renderer->GetRenderMode() == ::Effekseer::RenderMode::Wireframe) {
-			state |= BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_ADD, BGFX_STATE_BLEND_EQUATION_MAX);
-			state |= BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE);
-		}
-	else if (m_next.AlphaBlend == ::Effekseer::AlphaBlendType::Sub)	{
-		state |= BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_REVSUB, BGFX_STATE_BLEND_EQUATION_ADD);
-		state |= BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_ONE);
-	} else {
-		state |= BGFX_STATE_BLEND_EQUATION_SEPARATE(BGFX_STATE_BLEND_EQUATION_ADD, BGFX_STATE_BLEND_EQUATION_ADD);
-		if (m_next.AlphaBlend == ::Effekseer::AlphaBlendType::Blend) {
-			state |= BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE);
-		} else if (m_next.AlphaBlend == ::Effekseer::AlphaBlendType::Add) {
-			state |= BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_ONE);
-		} else if (m_next.AlphaBlend == ::Effekseer::AlphaBlendType::Mul) {
-			state |= BGFX_STATE_BLEND_FUNC_SEPARATE(BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_SRC_COLOR, BGFX_STATE_BLEND_ZERO, BGFX_STATE_BLEND_ONE);
-		}
-	}
-	m_renderer->SetCurrentState(state);
+void RenderState::Update(bool forced) {
+	(void)forced;	// ignore forced, the renderer skips the unchanged state
+	int blend = (int)m_next.AlphaBlend;
+	if (m_renderer->GetRenderMode() == ::Effekseer::RenderMode::Wireframe) {
+		blend = (int)::Effekseer::AlphaBlendType::Opacity;
+	}
+	const int culling = (int)m_next.CullingType;
+	assert(blend >= 0 && blend < STATE_BLEND_COUNT && culling >= 0 && culling < STATE_CULLING_COUNT);
+	m_renderer->SetCurrentState(m_table[m_next.DepthTest][m_next.DepthWrite][culling][blend]);
 	m_active = m_next;
 }
 
@@ -1504,6 +3012,129 @@ Texture::~Texture() {
 	m_render->ReleaseTexture(this);
 }
 
+bool MappedFile::Open(const char16_t *path) {
+	Close();
+#ifdef _WIN32
+	HANDLE file = CreateFileW((const wchar_t *)path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (m_mapping == nullptr)
+		return false;
+	m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_data == nullptr) {
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+#else
+	char buffer[MAX_PATH];
+	Effekseer::ConvertUtf16ToUtf8(buffer, MAX_PATH, path);
+	int fd = open(buffer, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+	m_data = data;
+	m_size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close() {
+	if (m_data == nullptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	m_mapping = nullptr;
+#else
+	munmap(m_data, m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+// "a\b/./c/../d" -> "a/b/d"
+static std::string NormalizePath(const char *path) {
+	std::vector<std::string> parts;
+	std::string part;
+	const bool absolute = path[0] == '/' || path[0] == '\\';
+	for (const char *p = path;; ++p) {
+		if (*p == '/' || *p == '\\' || *p == '\0') {
+			if (part == "..") {
+				if (!parts.empty() && parts.back() != "..")
+					parts.pop_back();
+				else
+					parts.push_back(part);
+			} else if (!part.empty() && part != ".") {
+				parts.push_back(part);
+			}
+			part.clear();
+			if (*p == '\0')
+				break;
+		} else {
+			part += *p;
+		}
+	}
+	std::string ret = absolute ? "/" : "";
+	for (size_t i=0;i<parts.size();i++) {
+		if (i > 0)
+			ret += '/';
+		ret += parts[i];
+	}
+	return ret;
+}
+
+Effekseer::TextureRef TextureLoader::Load(const char16_t* path, Effekseer::TextureType textureType) {
+	char buffer[MAX_PATH];
+	Effekseer::ConvertUtf16ToUtf8(buffer, MAX_PATH, path);
+	const std::string key = std::to_string((int)textureType) + ":" + NormalizePath(buffer);
+	auto texture = m_render->AcquireTexture(key);
+	if (texture != nullptr)
+		return texture;
+
+	// always create gamma space texture, Effekseer will convert color in shader with MiscFlag set to convert
+	const int srgb = 0; //textureType == Effekseer::TextureType::Color;
+	int id = m_loader(buffer, srgb, m_ud);
+	if (id < 0)
+		return nullptr;
+
+	texture = Effekseer::MakeRefPtr<Effekseer::Texture>();
+	texture->SetBackend(Effekseer::MakeRefPtr<Texture>(m_render, id, m_render->GetTextureGeneration(id)));
+	auto cached = m_render->AddTexture(key, buffer, srgb, texture);
+	if (cached != texture) {
+		// Loaded by another thread at the same time
+		UnloadId(texture);
+	}
+	return cached;
+}
+
+void TextureLoader::Unload(Effekseer::TextureRef texture) {
+	if (m_render->ReleaseCachedTexture(texture))
+		UnloadId(texture);
+}
+
+void TextureLoader::UnloadId(const Effekseer::TextureRef& texture) {
+	int id = texture->GetBackend().DownCast<Texture>()->RemoveId();
+	m_render->ReleaseTextureId(id);
+	m_unloader(id, m_ud);
+}
+
 // Create Renderer
 
 EffekseerRenderer::RendererRef CreateRenderer(struct InitArgs *init) {
@@ -1514,6 +3145,61 @@ EffekseerRenderer::RendererRef CreateRenderer(struct InitArgs *init) {
 	return nullptr;
 }
 
+EffekseerRenderer::RendererRef CreateWorkerRenderer(EffekseerRenderer::RendererRef renderer) {
+	auto worker = Effekseer::MakeRefPtr<RendererImplemented>();
+	if (worker->InitializeWorker(renderer.DownCast<RendererImplemented>().Get())) {
+		return worker;
+	}
+	return nullptr;
+}
+
+void SetVertexBufferMode(EffekseerRenderer::RendererRef renderer, int mode) {
+	renderer.DownCast<RendererImplemented>()->SetVertexBufferMode(mode);
+}
+
+void SetDistortionMode(EffekseerRenderer::RendererRef renderer, int mode) {
+	renderer.DownCast<RendererImplemented>()->SetDistortionMode(mode);
+}
+
+void SetCapture(EffekseerRenderer::RendererRef renderer, const struct CaptureArgs *capture) {
+	renderer.DownCast<RendererImplemented>()->SetCapture(capture);
+}
+
+void GetCaptureStats(EffekseerRenderer::RendererRef renderer, struct CaptureStats *stats) {
+	renderer.DownCast<RendererImplemented>()->GetCaptureStats(stats);
+}
+
+bool PrewarmShaders(EffekseerRenderer::RendererRef renderer) {
+	return renderer.DownCast<RendererImplemented>()->PrewarmShaders();
+}
+
+bool Prewarm(EffekseerRenderer::RendererRef renderer, Effekseer::EffectRef effect, struct PrewarmReport *report) {
+	PrewarmReport tmp;
+	if (effect == nullptr)
+		return false;
+	return renderer.DownCast<RendererImplemented>()->Prewarm(effect.Get(), report ? report : &tmp);
+}
+
+void NextFrame(EffekseerRenderer::RendererRef renderer) {
+	renderer.DownCast<RendererImplemented>()->NextFrame();
+}
+
+void SetTextureHandle(EffekseerRenderer::RendererRef renderer, int id, bgfx_texture_handle_t handle, int size) {
+	renderer.DownCast<RendererImplemented>()->SetTextureHandle(id, handle, size);
+}
+
+void SetTextureBudget(EffekseerRenderer::RendererRef renderer, int bytes) {
+	renderer.DownCast<RendererImplemented>()->SetTextureBudget(bytes);
+}
+
+void GetTextureCacheStats(EffekseerRenderer::RendererRef renderer, struct TextureCacheStats *stats) {
+	renderer.DownCast<RendererImplemented>()->GetTextureCacheStats(stats);
+}
+
+void GetFrameStats(EffekseerRenderer::RendererRef renderer, struct FrameStats *stats) {
+	renderer.DownCast<RendererImplemented>()->GetFrameStats(stats);
+}
+
 Effekseer::ModelRendererRef CreateModelRenderer(EffekseerRenderer::RendererRef renderer, struct InitArgs *init){
 	auto modelRenderer = renderer->CreateModelRenderer();
 	return modelRenderer.DownCast<RendererImplemented::ModelRenderer>()->Initialize(init) ? modelRenderer : nullptr;
@@ -18,6 +18,19 @@
 #define TEXTURE_BACKGROUND 0
 #define TEXTURE_DEPTH 1
 
+#define STATS_LAYOUT_LIGHTING 0
+#define STATS_LAYOUT_SIMPLE 1
+#define STATS_LAYOUT_ADVLIGHTING 2
+#define STATS_LAYOUT_ADVSIMPLE 3
+#define STATS_LAYOUT_MATERIAL 4
+#define STATS_LAYOUT_COUNT 5
+
+#define VERTEX_BUFFER_TRANSIENT 0
+#define VERTEX_BUFFER_DYNAMIC 1
+
+#define DISTORTION_EVERY_BATCH 0
+#define DISTORTION_ONCE_PER_FRAME 1
+
 namespace EffekseerRendererBGFX {
 	struct DepthReconstructionParameter	{
 		float DepthBufferScale;
@@ -39,9 +52,112 @@ namespace EffekseerRendererBGFX {
 		bgfx_texture_handle_t (*texture_handle)(int id, void *ud);	// translate id to handle
 		void * ud;
 		bool invz;
+		bool sequentialView;	// The view is in sequential mode, so unchanged uniforms are not submitted again.
+		int vertexBufferMode;	// VERTEX_BUFFER_TRANSIENT or VERTEX_BUFFER_DYNAMIC
+		const void * (*model_load)(const char *name, size_t *size, void *ud);	// optional, NULL to map the files
+		void (*model_unload)(const void *data, size_t size, void *ud);	// release the data from model_load
+		const void * (*material_load)(const char *name, size_t *size, void *ud);	// optional, NULL to map the files
+		void (*material_unload)(const void *data, size_t size, void *ud);	// release the data from material_load
+		int distortionMode;	// DISTORTION_EVERY_BATCH or DISTORTION_ONCE_PER_FRAME
+	};
+
+	struct FrameStats {
+		int drawCalls;
+		int spriteDrawCalls;	// submits of DrawSprites
+		int modelDrawCalls;	// submits of DrawPolygonInstanced (instanced models are counted once per batch)
+		int sprites[STATS_LAYOUT_COUNT];	// sprites drawn per vertex layout
+		int uniformSubmits;	// encoder_set_uniform calls
+		int uniformSkips;	// unchanged uniforms which are not submitted
+		int uniformBytes;	// bytes of uniforms submitted
+		int textureBinds;	// encoder_set_texture calls
+		int stateChanges;	// encoder_set_state calls by RenderState::Update
+		int stateSkips;	// unchanged render states which are not set
+		int forcedFlushes;	// sprites drawn before the end, because of state change or full vertex buffer
+		int backgroundGrabs;	// distorting callback calls
+		int vertexBytesAllocated;	// transient vertex buffer allocated
+		int vertexBytesUsed;	// transient vertex buffer filled by sprites
+		int vertexDropped;	// vertices not drawn because of out of transient vertex buffer
+		int instanceDropped;	// models not drawn because of out of instance data buffer
+	};
+
+	// The scene textures copied by the renderer, See SetCapture
+	struct CaptureArgs {
+		bgfx_view_id_t viewid;	// The view to blit in, it should be after the scene is drawn and before InitArgs::viewid
+		uint16_t width;
+		uint16_t height;
+		bgfx_texture_handle_t color;	// The scene color (render target) for TEXTURE_BACKGROUND, BGFX_INVALID_HANDLE to use texture_get
+		bgfx_texture_format_t colorFormat;
+		bgfx_texture_handle_t depth;	// The scene depth for TEXTURE_DEPTH, BGFX_INVALID_HANDLE to use texture_get
+		bgfx_texture_format_t depthFormat;
+	};
+
+	struct CaptureStats {
+		int colorCaptures;	// frames which copied the scene color
+		int depthCaptures;
+		int colorSkips;	// frames which didn't need the scene color
+		int depthSkips;
+	};
+
+	// What Prewarm created for an effect, the times are in microseconds.
+	struct PrewarmReport {
+		int programs;	// built-in programs
+		int materialsReady;	// user defined materials with shaders, they are created by the material loader, not by Prewarm
+		int models;	// models uploaded to vertex/index buffers
+		int layouts;	// vertex layouts, and dynamic vertex buffers in VERTEX_BUFFER_DYNAMIC mode
+		int textures;	// textures which get a valid handle in this call (by texture_handle, or reloaded), not the ones in the table already
+		int texturesPending;	// textures without handle yet (not loaded by texture_load/texture_handle)
+		int failures;	// programs, materials, models or buffers which can't be created
+		double programTime;
+		double modelTime;
+		double layoutTime;
+		double textureTime;
+	};
+
+	struct TextureCacheStats {
+		int hits;	// textures loaded from cache
+		int misses;	// textures loaded by texture_load
+		int textures;	// textures in cache now
+		int residentBytes;	// size of the loaded textures, updated by NextFrame
+		int evictions;	// textures unloaded for the budget
+		int reloads;	// evicted textures loaded again
 	};
 
 	EFXBGFX_API EffekseerRenderer::RendererRef CreateRenderer(struct InitArgs *init);
+	// Create a renderer for another thread, it shares shaders, index buffer and textures with `renderer`,
+	// but has its own encoder, transient buffers and states. Use one worker renderer per Manager::Draw thread.
+	EFXBGFX_API EffekseerRenderer::RendererRef CreateWorkerRenderer(EffekseerRenderer::RendererRef renderer);
+	// The built-in shaders are loaded (by shader_load) on first use. Load all of them now, to avoid the cost in the first frames.
+	// Returns false if any of them can't be loaded, the batches which use it are dropped.
+	EFXBGFX_API bool PrewarmShaders(EffekseerRenderer::RendererRef renderer);
+	// Create the programs, layouts, buffers and texture handles used by an effect (after it's loaded), instead of in its first frame.
+	// report can be NULL. Returns false if anything can't be created. Call it in the thread which calls NextFrame, not during Manager::Draw.
+	EFXBGFX_API bool Prewarm(EffekseerRenderer::RendererRef renderer, Effekseer::EffectRef effect, struct PrewarmReport *report);
+	// Switch vertex buffer mode of sprites at runtime (between frames) : VERTEX_BUFFER_TRANSIENT or VERTEX_BUFFER_DYNAMIC
+	// The mode is shared by the renderer and its workers, but the workers always use the transient vertex buffer.
+	// In VERTEX_BUFFER_DYNAMIC mode, NextFrame must be called every frame (the dynamic vertex buffers are created in it),
+	// and the vertices use the transient vertex buffer once the segment of the frame is full.
+	EFXBGFX_API void SetVertexBufferMode(EffekseerRenderer::RendererRef renderer, int mode);
+	// DISTORTION_EVERY_BATCH : the background is grabbed (by the distorting callback) before each distortion batch, so distortions see each other.
+	// DISTORTION_ONCE_PER_FRAME : the background is grabbed once per BeginRendering, and the distortion batches are drawn like other sprites.
+	EFXBGFX_API void SetDistortionMode(EffekseerRenderer::RendererRef renderer, int mode);
+	// Let the renderer copy the scene color and depth into its own textures (by blit in capture->viewid), instead of calling texture_get.
+	// The copy is made at most once per BeginRendering of the renderer (shared by its workers), and only if a batch needs it. Pass NULL to stop capturing.
+	EFXBGFX_API void SetCapture(EffekseerRenderer::RendererRef renderer, const struct CaptureArgs *capture);
+	EFXBGFX_API void GetCaptureStats(EffekseerRenderer::RendererRef renderer, struct CaptureStats *stats);
+	// Call it once per frame (after bgfx_frame) in VERTEX_BUFFER_DYNAMIC mode, or with a texture budget.
+	EFXBGFX_API void NextFrame(EffekseerRenderer::RendererRef renderer);
+	// Set the handle of a texture id returned by texture_load, when the texture is loaded or changed.
+	// The renderer uses it instead of calling texture_handle, pass BGFX_INVALID_HANDLE to remove it.
+	// size is the memory size in bytes, for the texture budget.
+	// It can be called in any thread, the entry is updated atomically, so Manager::Draw of any (worker) renderer sees the old handle or the new one.
+	EFXBGFX_API void SetTextureHandle(EffekseerRenderer::RendererRef renderer, int id, bgfx_texture_handle_t handle, int size = 0);
+	// Unload the textures not used recently (at NextFrame) when the size of textures is larger than the budget (0 means no limit).
+	// When they are used again, a white texture is drawn in that frame, and they are loaded again by texture_load in the next NextFrame (or Prewarm).
+	EFXBGFX_API void SetTextureBudget(EffekseerRenderer::RendererRef renderer, int bytes);
+	// Get the statistics of texture cache since the renderer is created.
+	EFXBGFX_API void GetTextureCacheStats(EffekseerRenderer::RendererRef renderer, struct TextureCacheStats *stats);
+	// Get the counters since last BeginRendering.
+	EFXBGFX_API void GetFrameStats(EffekseerRenderer::RendererRef renderer, struct FrameStats *stats);
 	EFXBGFX_API Effekseer::ModelRendererRef CreateModelRenderer(EffekseerRenderer::RendererRef renderer, struct InitArgs *init);
 }
 
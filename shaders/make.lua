@@ -50,6 +50,22 @@ for _, s in ipairs(get_shaders_info(vulkan_shader_dir)) do
     cvt2bgfxshader(input, scfile, s.shadertype, s.stage, s.modeltype)
 end
 
+-- instancing variants of the model vertex shaders (not advanced), named modelinst_*
+local instancing_shadertype<const> = {
+    Unlit = true,
+    Lit = true,
+    BackDistortion = true,
+}
+
+for _, s in ipairs(get_shaders_info(vulkan_shader_dir)) do
+    if s.modeltype == "model" and s.stage == "vs" and instancing_shadertype[s.shadertype] then
+        local input = vulkan_shader_dir / s.filename
+        local scfile = shader_output_dir / fs.path((s.filename:gsub("^model_", "modelinst_"))):replace_extension "sc"
+        scfiles[#scfiles+1] = scfile
+        cvt2bgfxshader(input, scfile, s.shadertype, s.stage, "modelinst")
+    end
+end
+
 lm:phony "efxbgfx_shaders" {
     input = scfiles
 }
\ No newline at end of file
@@ -0,0 +1,16 @@
+vec3 a_position : POSITION;
+vec3 a_normal : NORMAL;
+vec3 a_bitangent : BITANGENT;
+vec3 a_tangent : TANGENT;
+vec2 a_texcoord0 : TEXCOORD0;
+vec4 a_color0 : COLOR0;
+vec4 i_data0 : TEXCOORD7;
+vec4 i_data1 : TEXCOORD6;
+vec4 i_data2 : TEXCOORD5;
+vec4 i_data3 : TEXCOORD4;
+vec4 i_data4 : TEXCOORD3;
+vec2 v_UV : TEXCOORD0;
+vec4 v_ProjBinormal : TEXCOORD1;
+vec4 v_ProjTangent : TEXCOORD2;
+vec4 v_PosP : TEXCOORD3;
+vec4 v_Color : TEXCOORD4;
\ No newline at end of file
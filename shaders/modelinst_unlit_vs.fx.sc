@@ -0,0 +1,78 @@
+$input a_position a_normal a_bitangent a_tangent a_texcoord0 a_color0 i_data0 i_data1 i_data2 i_data3 i_data4
+$output v_Color v_UV v_PosP
+
+#include <bgfx_shader.sh>
+#include "defines.sh"
+uniform mat4 u_mCameraProj;
+uniform vec4 u_fLightDirection;
+uniform vec4 u_fLightColor;
+uniform vec4 u_fLightAmbient;
+uniform vec4 u_mUVInversed;
+
+
+struct VS_Input
+{
+    vec3 Pos;
+    vec3 Normal;
+    vec3 Binormal;
+    vec3 Tangent;
+    vec2 UV;
+    vec4 Color;
+    uint Index;
+    vec4 InstModel0;
+    vec4 InstModel1;
+    vec4 InstModel2;
+    vec4 InstUV;
+    vec4 InstColor;
+};
+
+struct VS_Output
+{
+    vec4 PosVS;
+    vec4 Color;
+    vec2 UV;
+    vec4 PosP;
+};
+
+VS_Output _main(VS_Input Input)
+{
+    uint index = Input.Index;
+    mat4 mModel = mtxFromRows(Input.InstModel0, Input.InstModel1, Input.InstModel2, vec4(0.0, 0.0, 0.0, 1.0));
+    vec4 uv = Input.InstUV;
+    vec4 modelColor = Input.InstColor * Input.Color;
+    VS_Output Output = (VS_Output)0;
+    vec4 localPos = vec4(Input.Pos.x, Input.Pos.y, Input.Pos.z, 1.0);
+    vec4 worldPos = mul(mModel, localPos);
+    Output.PosVS = mul(u_mCameraProj, worldPos);
+    Output.Color = modelColor;
+    vec2 outputUV = Input.UV;
+    outputUV.x = (outputUV.x * uv.z) + uv.x;
+    outputUV.y = (outputUV.y * uv.w) + uv.y;
+    outputUV.y = u_mUVInversed.x + (u_mUVInversed.y * outputUV.y);
+    Output.UV = outputUV;
+    Output.PosP = Output.PosVS;
+    return Output;
+}
+
+void main()
+{
+    VS_Input Input;
+    Input.Pos = a_position;
+    Input.Normal = a_normal;
+    Input.Binormal = a_bitangent;
+    Input.Tangent = a_tangent;
+    Input.UV = a_texcoord0;
+    Input.Color = a_color0;
+    Input.Index = uint(gl_InstanceIndex);
+    Input.InstModel0 = i_data0;
+    Input.InstModel1 = i_data1;
+    Input.InstModel2 = i_data2;
+    Input.InstUV = i_data3;
+    Input.InstColor = i_data4;
+    VS_Output flattenTemp = _main(Input);
+    vec4 _position = flattenTemp.PosVS;
+    gl_Position = _position;
+    v_Color = flattenTemp.Color;
+    v_UV = flattenTemp.UV;
+    v_PosP = flattenTemp.PosP;
+}